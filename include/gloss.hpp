@@ -3,14 +3,20 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <future>
 #include <vector>
 #include <utility>
 
+#include "los_result.hpp"
+
 using Coordinate = std::pair<double, double>;
 using Elevation = float;
 using CoordinateElevationPair = std::pair<Coordinate, Elevation>;
 using Grid = std::vector<std::vector<CoordinateElevationPair>>;
-using AntennaDict = std::map<int, Grid>;
+using HorizonTransition = std::pair<double, gloss::LoSClass>; // Distance along the ray in meters, class from there on
+using RayHorizons = std::vector<std::vector<HorizonTransition>>;
+using AntennaDict = std::map<int, gloss::LoSResult>;
 
 
 namespace gloss {
@@ -30,9 +36,66 @@ namespace gloss {
         }
     };
 
-    void initialize(const std::string& antennaFile, const std::string& tiffFile, const std::string& groundTiffFile);
+    /**
+     * @brief Opens the antenna file and the DSM/ground rasters
+     * @param inMemory Load both rasters once into contiguous float32 arrays instead of reading blocks on demand
+     */
+    void initialize(const std::string& antennaFile, const std::string& tiffFile, const std::string& groundTiffFile, bool inMemory = false);
     AntennaDict compute();
+
+    struct ComputeState;
+
+    /**
+     * @brief Handle on a computation running on the thread pool, returned by computeAsync()
+     */
+    class ComputeHandle {
+    public:
+        ComputeHandle(std::shared_ptr<ComputeState> state, std::shared_future<AntennaDict> future);
+
+        bool done() const;
+
+        /**
+         * @brief Fraction of the antennas computed so far, from 0 to 1
+         */
+        double progress() const;
+
+        /**
+         * @brief Skips the antennas not started yet. result() then throws once the running ones finish.
+         */
+        void cancel();
+
+        /**
+         * @brief Waits for the computation and returns its results, or rethrows its error
+         */
+        const AntennaDict& result() const;
+
+    private:
+        std::shared_ptr<ComputeState> state;
+        std::shared_future<AntennaDict> future;
+    };
+
+    /**
+     * @brief Starts compute() on the thread pool and returns immediately
+     */
+    ComputeHandle computeAsync();
+
+    /**
+     * @brief Expands a result to one (coordinate, elevation) pair per sample, the layout of the JSON datasets
+     */
+    Grid toGrid(const LoSResult& result);
+
+    /**
+     * @brief Summarizes every ray of a result as the distances where its class changes, one list per ray
+     *
+     * Each list starts with the class of the first sample. Raster (viewshed) results have no rays and are rejected.
+     */
+    RayHorizons toHorizons(const LoSResult& result);
     void saveResults(const AntennaDict& antennaDict);
+
+    /**
+     * @brief Reads binary datasets written by saveResults(), from one .glos file or a directory of them
+     */
+    AntennaDict loadResults(const std::string& path);
 } // namespace gloss
 
 #endif // GLOSS_HPP
\ No newline at end of file
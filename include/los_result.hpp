@@ -0,0 +1,226 @@
+#ifndef LOS_RESULT_HPP
+#define LOS_RESULT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "pixel_ray.hpp"
+
+namespace gloss {
+
+    /**
+     * @brief Classification of one sample, stored on one byte
+     *
+     * Values are the elevations written in the JSON datasets, so a code can be used as is.
+     */
+    enum class LoSClass : uint8_t {
+        NLoS = 0,
+        OutsideRegion = 25, // Assumes that the points outside the upper and lower region bounds of the antenna are null.
+        LoSInBuilding = 50,
+        LoS = 100,
+        NoData = 200, // Sample outside the DSM or on one of its nodata pixels, nothing is known about it
+        NoSample = 255 // Padding after the last sample of a ray shorter than the longest one
+    };
+
+    /**
+     * @brief Geometry of one ray cast from the antenna
+     *
+     * Samples are evenly spaced between the origin and the end, or are the DSM pixels crossed
+     * between the pixel endpoints when pixelSpace is set.
+     */
+    struct RayGeometry {
+        double bearing = 0.0;
+        std::pair<double, double> end;
+        int numSamples = 0;
+        bool pixelSpace = false;
+        double startPx = 0.0;
+        double startPy = 0.0;
+        double endPx = 0.0;
+        double endPy = 0.0;
+    };
+
+    /**
+     * @brief Part of the DSM covered by a raster result
+     *
+     * geoTransform is the one of the whole DSM, the window starts at pixel xOff, line yOff.
+     */
+    struct RasterWindow {
+        int xOff = 0;
+        int yOff = 0;
+        int width = 0;
+        int height = 0;
+        double geoTransform[6] = {0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    };
+
+    /**
+     * @brief LoS classification of every ray of one antenna
+     *
+     * Only the ray geometry and one code per sample are stored, in a rays x stride array
+     * padded with LoSClass::NoSample. Sample coordinates are rebuilt on demand from the
+     * origin and the ray geometry, exactly as the samples were generated.
+     *
+     * Viewshed results use a raster layout instead: one code per DSM cell of a window,
+     * rows x columns, with no rays.
+     */
+    class LoSResult {
+    public:
+        LoSResult() = default;
+
+        LoSResult(std::pair<double, double> origin, const RasterWindow& window)
+            : origin(origin)
+            , raster(true)
+            , window(window)
+            , stride(static_cast<size_t>(std::max(window.width, 0))) {
+            codes.assign(static_cast<size_t>(std::max(window.height, 0)) * stride, static_cast<uint8_t>(LoSClass::NoSample));
+        }
+
+        LoSResult(std::pair<double, double> origin, std::vector<RayGeometry> rays)
+            : origin(origin)
+            , rays(std::move(rays)) {
+            for (const RayGeometry& ray : this->rays) {
+                stride = std::max(stride, static_cast<size_t>(std::max(ray.numSamples, 0)));
+            }
+            codes.assign(this->rays.size() * stride, static_cast<uint8_t>(LoSClass::NoSample));
+        }
+
+        const std::pair<double, double>& getOrigin() const {
+            return origin;
+        }
+
+        size_t getNumRays() const {
+            return rays.size();
+        }
+
+        bool isRaster() const {
+            return raster;
+        }
+
+        const RasterWindow& getRasterWindow() const {
+            return window;
+        }
+
+        // Rows of codes: one per ray, or one per raster line
+        size_t getNumRows() const {
+            return raster ? static_cast<size_t>(window.height) : rays.size();
+        }
+
+        // Length of a row of codes, the sample count of the longest ray or the raster width
+        size_t getStride() const {
+            return stride;
+        }
+
+        // Center of a raster cell in the CRS of the DSM
+        std::pair<double, double> getCellCenter(int row, int column) const {
+            double pixel = window.xOff + column + 0.5;
+            double line = window.yOff + row + 0.5;
+            const double* gt = window.geoTransform;
+            return {gt[0] + pixel * gt[1] + line * gt[2], gt[3] + pixel * gt[4] + line * gt[5]};
+        }
+
+        const RayGeometry& getRay(size_t ray) const {
+            return rays[ray];
+        }
+
+        int getNumSamples(size_t ray) const {
+            return rays[ray].numSamples;
+        }
+
+        LoSClass getClass(size_t ray, int sample) const {
+            return static_cast<LoSClass>(codes[ray * stride + sample]);
+        }
+
+        void setClass(size_t ray, int sample, LoSClass value) {
+            codes[ray * stride + sample] = static_cast<uint8_t>(value);
+        }
+
+        uint8_t* getRayCodes(size_t ray) {
+            return codes.data() + ray * stride;
+        }
+
+        const uint8_t* getRayCodes(size_t ray) const {
+            return codes.data() + ray * stride;
+        }
+
+        // Codes of one raster line, left to right
+        uint8_t* getRowCodes(size_t row) {
+            return codes.data() + row * stride;
+        }
+
+        const uint8_t* getRowCodes(size_t row) const {
+            return codes.data() + row * stride;
+        }
+
+        const std::vector<uint8_t>& getCodes() const {
+            return codes;
+        }
+
+        /**
+         * @brief Lat/lon of one sample
+         *
+         * Constant time for evenly spaced rays, pixel rays are traversed up to the sample.
+         */
+        std::pair<double, double> getCoordinate(size_t ray, int sample) const {
+            const RayGeometry& geometry = rays[ray];
+            if (!geometry.pixelSpace) {
+                return interpolate(geometry, sampleFraction(geometry, sample));
+            }
+
+            PixelRay traversal(geometry.startPx, geometry.startPy, geometry.endPx, geometry.endPy);
+            int pixel, line;
+            double t = 0.0;
+            for (int i = 0; i <= sample && traversal.next(pixel, line, t); ++i) {
+            }
+            return interpolate(geometry, t);
+        }
+
+        // Lat/lon of all the samples of a ray, in order
+        std::vector<std::pair<double, double>> getCoordinates(size_t ray) const {
+            const RayGeometry& geometry = rays[ray];
+            std::vector<std::pair<double, double>> coordinates;
+            coordinates.reserve(geometry.numSamples);
+
+            if (!geometry.pixelSpace) {
+                for (int i = 0; i < geometry.numSamples; ++i) {
+                    coordinates.push_back(interpolate(geometry, sampleFraction(geometry, i)));
+                }
+                return coordinates;
+            }
+
+            PixelRay traversal(geometry.startPx, geometry.startPy, geometry.endPx, geometry.endPy);
+            int pixel, line;
+            double t;
+            while (traversal.next(pixel, line, t)) {
+                coordinates.push_back(interpolate(geometry, t));
+            }
+            return coordinates;
+        }
+
+        // Heap bytes held by the result
+        size_t getMemoryUsage() const {
+            return codes.capacity() + rays.capacity() * sizeof(RayGeometry);
+        }
+
+    private:
+        // Position of an evenly spaced sample along its ray, a single-sample ray being its start
+        static double sampleFraction(const RayGeometry& geometry, int sample) {
+            return geometry.numSamples > 1 ? static_cast<double>(sample) / (geometry.numSamples - 1) : 0.0;
+        }
+
+        std::pair<double, double> interpolate(const RayGeometry& geometry, double t) const {
+            return {origin.first + t * (geometry.end.first - origin.first),
+                    origin.second + t * (geometry.end.second - origin.second)};
+        }
+
+        std::pair<double, double> origin;
+        bool raster = false;
+        RasterWindow window;
+        std::vector<RayGeometry> rays;
+        size_t stride = 0;
+        std::vector<uint8_t> codes;
+    };
+
+} // namespace gloss
+
+#endif // LOS_RESULT_HPP
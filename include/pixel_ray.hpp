@@ -0,0 +1,79 @@
+#ifndef PIXEL_RAY_HPP
+#define PIXEL_RAY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace gloss {
+
+    /**
+     * @brief Amanatides-Woo traversal of the pixels crossed by a segment in raster space
+     *
+     * Coordinates are continuous pixel/line positions (pixel i covers [i, i + 1)).
+     * Every crossed pixel is visited exactly once, in order from start to end.
+     */
+    class PixelRay {
+    public:
+        PixelRay(double startX, double startY, double endX, double endY)
+            : pixel(static_cast<int>(std::floor(startX)))
+            , line(static_cast<int>(std::floor(startY))) {
+            const double inf = std::numeric_limits<double>::infinity();
+            double dx = endX - startX;
+            double dy = endY - startY;
+
+            stepX = dx > 0 ? 1 : -1;
+            stepY = dy > 0 ? 1 : -1;
+            tDeltaX = dx != 0 ? std::abs(1.0 / dx) : inf;
+            tDeltaY = dy != 0 ? std::abs(1.0 / dy) : inf;
+            tMaxX = dx != 0 ? (dx > 0 ? pixel + 1 - startX : startX - pixel) * tDeltaX : inf;
+            tMaxY = dy != 0 ? (dy > 0 ? line + 1 - startY : startY - line) * tDeltaY : inf;
+        }
+
+        /**
+         * @brief Moves to the next crossed pixel
+         * @param t Segment parameter (0 at start, 1 at end) of the middle of the part of the segment inside the pixel
+         * @return false once the end of the segment has been passed
+         */
+        bool next(int& outPixel, int& outLine, double& t) {
+            if (done) return false;
+
+            double tExit = std::min(std::min(tMaxX, tMaxY), 1.0);
+            outPixel = pixel;
+            outLine = line;
+            t = (tEnter + tExit) / 2.0;
+
+            if (tExit >= 1.0) {
+                done = true;
+                return true;
+            }
+
+            // Crossing exactly through a corner moves diagonally instead of visiting a zero-length pixel
+            tEnter = tExit;
+            if (tMaxX <= tExit) {
+                pixel += stepX;
+                tMaxX += tDeltaX;
+            }
+            if (tMaxY <= tExit) {
+                line += stepY;
+                tMaxY += tDeltaY;
+            }
+            return true;
+        }
+
+    private:
+        int pixel;
+        int line;
+        int stepX;
+        int stepY;
+        double tDeltaX;
+        double tDeltaY;
+        double tMaxX;
+        double tMaxY;
+        double tEnter = 0.0;
+        bool done = false;
+    };
+
+} // namespace gloss
+
+#endif // PIXEL_RAY_HPP
@@ -160,6 +160,7 @@ setup(
     ext_modules=[CMakeExtension("gloss")],
     cmdclass={"build_ext": CMakeBuild},
     zip_safe=False,
+    install_requires=["numpy"],
     extras_require={
         "test": ["pytest>=6.0"],
         "dev": ["pytest>=6.0", "build", "twine"],
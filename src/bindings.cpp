@@ -5,11 +5,14 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 
 #include "utils.hpp"
 #include "gloss.cpp"
 
 #include <iostream>
+#include <cstring>
+#include <unordered_set>
 
 using namespace std;
 using namespace gloss; 
@@ -27,6 +30,216 @@ string getVersion() {
 
 namespace py = pybind11;
 
+// Read-only rows x stride view of the codes of a result. The array keeps the result alive.
+py::array_t<uint8_t> getClassArray(py::object self) {
+    const LoSResult& result = self.cast<const LoSResult&>();
+    size_t stride = result.getStride();
+    py::array_t<uint8_t> classes({result.getNumRows(), stride}, {stride, size_t(1)}, result.getCodes().data(), self);
+    classes.attr("setflags")(py::arg("write") = false);
+    return classes;
+}
+
+// Read-only height x width view of one of the coverage maps. The array keeps the maps alive.
+template <typename T>
+py::array_t<T> getCoverageArray(py::object self, const std::vector<T>& (CoverageMaps::*map)() const) {
+    const CoverageMaps& coverage = self.cast<const CoverageMaps&>();
+    size_t width = static_cast<size_t>(coverage.getWidth());
+    py::array_t<T> array({static_cast<size_t>(coverage.getHeight()), width}, {width * sizeof(T), sizeof(T)}, (coverage.*map)().data(), self);
+    array.attr("setflags")(py::arg("write") = false);
+    return array;
+}
+
+// Numeric antenna column read in place: any integer or float dtype, any stride, so fields of a
+// structured array and pandas columns are read without being converted or copied
+class AntennaColumn {
+public:
+    AntennaColumn(py::handle source, const std::string& name)
+        : array(py::array::ensure(source)) {
+        if (!array || array.ndim() != 1) {
+            throw std::invalid_argument("Antenna column " + name + " must be a 1-D array.");
+        }
+        kind = array.dtype().kind();
+        if ((kind != 'f' && kind != 'i' && kind != 'u') || !array.dtype().attr("isnative").cast<bool>()) {
+            throw std::invalid_argument("Antenna column " + name + " must hold native integers or floats.");
+        }
+        data = static_cast<const char*>(array.data());
+        stride = array.strides(0);
+        itemSize = array.itemsize();
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(array.shape(0));
+    }
+
+    double operator[](size_t i) const {
+        const char* item = data + static_cast<py::ssize_t>(i) * stride;
+        if (kind == 'f') {
+            return itemSize == 4 ? read<float>(item) : read<double>(item);
+        }
+        if (kind == 'i') {
+            return itemSize == 1 ? read<int8_t>(item) : itemSize == 2 ? read<int16_t>(item) : itemSize == 4 ? read<int32_t>(item) : read<int64_t>(item);
+        }
+        return itemSize == 1 ? read<uint8_t>(item) : itemSize == 2 ? read<uint16_t>(item) : itemSize == 4 ? read<uint32_t>(item) : read<uint64_t>(item);
+    }
+
+private:
+    template <typename T>
+    static double read(const char* item) {
+        T value;
+        std::memcpy(&value, item, sizeof(T));
+        return static_cast<double>(value);
+    }
+
+    py::array array;
+    const char* data = nullptr;
+    py::ssize_t stride = 0;
+    py::ssize_t itemSize = 0;
+    char kind = 'f';
+};
+
+const char* ANTENNA_COLUMNS[] = {"id", "lat", "lon", "height", "frequency", "erp", "name", "sector_width",
+                                 "azimuth", "dt", "bandwidth", "ba", "gnd_elevation"};
+
+// Column of a keyword argument, else of the table (structured array, dict or DataFrame), else None
+py::object getAntennaColumn(const py::object& table, const py::kwargs& columns, const char* name) {
+    if (columns.contains(name)) {
+        return columns[name];
+    }
+    if (!table.is_none()) {
+        try {
+            return table[py::str(name)];
+        } catch (py::error_already_set& e) {
+            if (!e.matches(PyExc_KeyError) && !e.matches(PyExc_ValueError) && !e.matches(PyExc_IndexError)) {
+                throw;
+            }
+        }
+    }
+    return py::none();
+}
+
+// Antennas built from one array per field, as the columns of the antenna file. The sector comes
+// from a name ("65SEC", "OMNI") or a sector_width in degrees, 360 or more being omnidirectional.
+void setAntennaArrays(py::object table, py::kwargs columns) {
+    for (auto item : columns) {
+        std::string key = py::str(item.first);
+        if (std::find_if(std::begin(ANTENNA_COLUMNS), std::end(ANTENNA_COLUMNS), [&](const char* c) { return key == c; }) == std::end(ANTENNA_COLUMNS)) {
+            throw std::invalid_argument("Unknown antenna column " + key + ".");
+        }
+    }
+
+    std::map<std::string, std::unique_ptr<AntennaColumn>> numeric;
+    size_t count = 0;
+    bool sized = false;
+    for (const char* name : ANTENNA_COLUMNS) {
+        if (std::string(name) == "name") {
+            continue;
+        }
+        py::object source = getAntennaColumn(table, columns, name);
+        if (source.is_none()) {
+            continue;
+        }
+        auto column = std::make_unique<AntennaColumn>(source, name);
+        if (sized && column->size() != count) {
+            throw std::invalid_argument(std::string("Antenna column ") + name + " has " + std::to_string(column->size()) + " rows, expected " + std::to_string(count) + ".");
+        }
+        count = column->size();
+        sized = true;
+        numeric[name] = std::move(column);
+    }
+    for (const char* required : {"lat", "lon", "height", "azimuth", "gnd_elevation"}) {
+        if (!numeric.count(required)) {
+            throw std::invalid_argument(std::string("Missing antenna column ") + required + ".");
+        }
+    }
+
+    py::object nameSource = getAntennaColumn(table, columns, "name");
+    std::vector<std::string> names;
+    if (!nameSource.is_none()) {
+        for (py::handle name : nameSource) {
+            names.push_back(py::isinstance<py::bytes>(name) ? std::string(name.cast<py::bytes>()) : std::string(py::str(name)));
+        }
+        if (names.size() != count) {
+            throw std::invalid_argument("Antenna column name has " + std::to_string(names.size()) + " rows, expected " + std::to_string(count) + ".");
+        }
+    } else if (!numeric.count("sector_width")) {
+        throw std::invalid_argument("Missing antenna column name or sector_width.");
+    }
+
+    auto find = [&](const char* name) -> const AntennaColumn* {
+        auto found = numeric.find(name);
+        return found == numeric.end() ? nullptr : found->second.get();
+    };
+    const AntennaColumn* ids = find("id");
+    const AntennaColumn* widths = find("sector_width");
+    const AntennaColumn* lats = find("lat");
+    const AntennaColumn* lons = find("lon");
+    const AntennaColumn* heights = find("height");
+    const AntennaColumn* frequencies = find("frequency");
+    const AntennaColumn* erps = find("erp");
+    const AntennaColumn* azimuths = find("azimuth");
+    const AntennaColumn* dts = find("dt");
+    const AntennaColumn* bandwidths = find("bandwidth");
+    const AntennaColumn* bas = find("ba");
+    const AntennaColumn* gndElevations = find("gnd_elevation");
+    auto value = [](const AntennaColumn* column, size_t i) {
+        return column ? (*column)[i] : 0.0;
+    };
+
+    // Results are keyed by id, antennas sharing one would overwrite each other's
+    std::unordered_set<int> seenIds;
+    std::vector<Antenna> antennas;
+    antennas.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        int id = ids ? static_cast<int>((*ids)[i]) : static_cast<int>(i + 1);
+        if (!seenIds.insert(id).second) {
+            throw std::invalid_argument("Duplicate antenna id " + std::to_string(id) + " at row " + std::to_string(i) + ".");
+        }
+        std::string name;
+        if (!names.empty()) {
+            name = names[i];
+        } else {
+            name = (*widths)[i] >= 360.0 ? "OMNI" : fmt::format("{}SEC", (*widths)[i]);
+        }
+        antennas.emplace_back(id, (*lats)[i], (*lons)[i], (*heights)[i],
+                              value(frequencies, i), value(erps, i), std::move(name), (*azimuths)[i], value(dts, i),
+                              value(bandwidths, i), value(bas, i), (*gndElevations)[i]);
+    }
+    gloss::setAntennas(std::move(antennas));
+}
+
+// Latitude and longitude of every sample as two rays x stride arrays, NaN past the end of a ray.
+// Raster results give the x and y of the cell centers in the CRS of the DSM instead.
+py::tuple getCoordinateArrays(const LoSResult& result) {
+    size_t numRays = result.getNumRows();
+    size_t stride = result.getStride();
+    py::array_t<double> lats({numRays, stride});
+    py::array_t<double> lons({numRays, stride});
+    double* latData = lats.mutable_data();
+    double* lonData = lons.mutable_data();
+    std::fill(latData, latData + numRays * stride, std::numeric_limits<double>::quiet_NaN());
+    std::fill(lonData, lonData + numRays * stride, std::numeric_limits<double>::quiet_NaN());
+
+    if (result.isRaster()) {
+        for (size_t row = 0; row < numRays; ++row) {
+            for (size_t column = 0; column < stride; ++column) {
+                Coordinate center = result.getCellCenter(static_cast<int>(row), static_cast<int>(column));
+                latData[row * stride + column] = center.first;
+                lonData[row * stride + column] = center.second;
+            }
+        }
+        return py::make_tuple(lats, lons);
+    }
+
+    for (size_t ray = 0; ray < numRays; ++ray) {
+        std::vector<Coordinate> coordinates = result.getCoordinates(ray);
+        for (size_t i = 0; i < coordinates.size(); ++i) {
+            latData[ray * stride + i] = coordinates[i].first;
+            lonData[ray * stride + i] = coordinates[i].second;
+        }
+    }
+    return py::make_tuple(lats, lons);
+}
+
 PYBIND11_MODULE(gloss, m) {
     m.doc() = R"pbdoc(
         Pybind11 gloss plugin
@@ -40,8 +253,26 @@ PYBIND11_MODULE(gloss, m) {
            printHelloWorld
            getVersion
            initialize
+           setAntennas
            compute
+           computeAsync
+           setCoverage
+           getCoverage
+           toGrid
+           toHorizons
            saveResults
+           setOutputFormat
+           loadResults
+           setTileCacheSize
+           getCacheStats
+           convertToGlossDem
+           setTraversalMode
+           setEngine
+           setAngularRefinement
+           getRayKernel
+           setRayKernel
+           setNumThreads
+           getNumThreads
     )pbdoc";
 
     m.def("printHelloWorld", &printHelloWorld, R"pbdoc(
@@ -54,17 +285,271 @@ PYBIND11_MODULE(gloss, m) {
 
     m.def("initialize", &gloss::initialize, R"pbdoc(
         Initializes the GLoSS module with antenna file, tiff file, and ground tiff file.
+        With in_memory=True both rasters are loaded once into RAM (city-scale DSMs).
     )pbdoc",
-        py::arg("antenna_file"), py::arg("tiff_file"), py::arg("ground_tiff_file"));
+        py::arg("antenna_file"), py::arg("tiff_file"), py::arg("ground_tiff_file"), py::arg("in_memory") = false);
+
+    m.def("setAntennas", &setAntennaArrays, R"pbdoc(
+        Sets the antennas of the next computations from arrays instead of the antenna file, one row per
+        antenna: a structured array, a dict of arrays or a DataFrame, and/or one keyword per column.
+        Columns are lat, lon, height and gnd_elevation (feet), azimuth, dt, frequency, erp, bandwidth,
+        ba, id (unique, default 1..n), and the sector as name ("65SEC", "OMNI") or sector_width in degrees.
+        Numeric columns of any integer or float dtype are read in place, without conversion or copy.
+        The antennas stay in use until another antenna file is passed to initialize().
+    )pbdoc",
+        py::arg("table") = py::none());
     
+    py::enum_<LoSClass>(m, "LoSClass")
+        .value("NLoS", LoSClass::NLoS)
+        .value("OutsideRegion", LoSClass::OutsideRegion)
+        .value("LoSInBuilding", LoSClass::LoSInBuilding)
+        .value("LoS", LoSClass::LoS)
+        .value("NoData", LoSClass::NoData)
+        .value("NoSample", LoSClass::NoSample);
+
+    py::class_<RasterWindow>(m, "RasterWindow", R"pbdoc(
+        DSM pixels covered by a viewshed result.
+    )pbdoc")
+        .def_readonly("xOff", &RasterWindow::xOff)
+        .def_readonly("yOff", &RasterWindow::yOff)
+        .def_readonly("width", &RasterWindow::width)
+        .def_readonly("height", &RasterWindow::height)
+        .def_property_readonly("geoTransform", [](const RasterWindow& w) {
+            return std::vector<double>(w.geoTransform, w.geoTransform + 6);
+        });
+
+    py::class_<LoSResult>(m, "LoSResult", py::buffer_protocol(), R"pbdoc(
+        LoS classification of every ray of one antenna, one byte per sample.
+        Sample coordinates are rebuilt on demand from the antenna position and ray geometry.
+        numpy.asarray(result) is a zero-copy rays x samples uint8 view of the codes.
+        Viewshed results (LoSEngine.Viewshed) are rasters: rows x columns of DSM cells, no rays.
+    )pbdoc")
+        .def_buffer([](LoSResult& r) {
+            return py::buffer_info(const_cast<uint8_t*>(r.getCodes().data()), sizeof(uint8_t),
+                                   py::format_descriptor<uint8_t>::format(), 2,
+                                   {r.getNumRows(), r.getStride()}, {r.getStride(), size_t(1)}, true);
+        })
+        .def("getOrigin", &LoSResult::getOrigin)
+        .def("isRaster", &LoSResult::isRaster)
+        .def("getRasterWindow", &LoSResult::getRasterWindow)
+        .def("getCellCenter", &LoSResult::getCellCenter, py::arg("row"), py::arg("column"))
+        .def("getNumRays", &LoSResult::getNumRays)
+        .def("getNumSamples", &LoSResult::getNumSamples, py::arg("ray"))
+        .def("getBearing", [](const LoSResult& r, size_t ray) { return r.getRay(ray).bearing; }, py::arg("ray"))
+        .def("getClass", &LoSResult::getClass, py::arg("ray"), py::arg("sample"))
+        .def("getClasses", [](const LoSResult& r, size_t ray) {
+            if (r.isRaster()) {
+                const uint8_t* codes = r.getRowCodes(ray);
+                return std::vector<uint8_t>(codes, codes + r.getStride());
+            }
+            const uint8_t* codes = r.getRayCodes(ray);
+            return std::vector<uint8_t>(codes, codes + r.getNumSamples(ray));
+        }, py::arg("ray"), R"pbdoc(
+            Returns the codes of one ray, or of one raster line for viewshed results.
+        )pbdoc")
+        .def("getCoordinate", &LoSResult::getCoordinate, py::arg("ray"), py::arg("sample"))
+        .def("getCoordinates", &LoSResult::getCoordinates, py::arg("ray"))
+        .def("getClassArray", &getClassArray, R"pbdoc(
+            Returns the codes as a read-only rays x samples uint8 array sharing the result's memory.
+            Rows shorter than the longest ray are padded with LoSClass.NoSample.
+        )pbdoc")
+        .def("getCoordinateArrays", &getCoordinateArrays, R"pbdoc(
+            Returns (latitudes, longitudes), two rays x samples float64 arrays, NaN where there is no sample.
+        )pbdoc")
+        .def("getBearings", [](const LoSResult& r) {
+            py::array_t<double> bearings(r.getNumRays());
+            for (size_t ray = 0; ray < r.getNumRays(); ++ray) {
+                bearings.mutable_at(ray) = r.getRay(ray).bearing;
+            }
+            return bearings;
+        })
+        .def("getSampleCounts", [](const LoSResult& r) {
+            py::array_t<int32_t> counts(r.getNumRays());
+            for (size_t ray = 0; ray < r.getNumRays(); ++ray) {
+                counts.mutable_at(ray) = r.getNumSamples(ray);
+            }
+            return counts;
+        })
+        .def("getMemoryUsage", &LoSResult::getMemoryUsage)
+        .def("__len__", &LoSResult::getNumRays)
+        .def("__repr__", [](const LoSResult& r) {
+            if (r.isRaster()) {
+                return fmt::format("<LoSResult raster={}x{}>", r.getRasterWindow().width, r.getRasterWindow().height);
+            }
+            return fmt::format("<LoSResult rays={} stride={}>", r.getNumRays(), r.getStride());
+        });
+
     m.def("compute", &gloss::compute, R"pbdoc(
-        Computes the LoS paths for the initialized antennas.
+        Computes the LoS paths for the initialized antennas, as a dict of antenna id to LoSResult.
+        The GIL is released while computing, so other Python threads keep running.
+    )pbdoc",
+        py::call_guard<py::gil_scoped_release>());
+
+    py::class_<ComputeHandle>(m, "ComputeHandle", R"pbdoc(
+        Handle on a computation started by computeAsync().
+    )pbdoc")
+        .def("done", &ComputeHandle::done, R"pbdoc(
+            Returns True once the computation has finished, failed or been cancelled.
+        )pbdoc")
+        .def("progress", &ComputeHandle::progress, R"pbdoc(
+            Returns the fraction of the antennas computed so far, from 0 to 1.
+        )pbdoc")
+        .def("cancel", &ComputeHandle::cancel, R"pbdoc(
+            Skips the antennas not started yet. result() then raises RuntimeError.
+        )pbdoc")
+        .def("result", &ComputeHandle::result, R"pbdoc(
+            Waits for the computation (without holding the GIL) and returns the same dict as compute().
+        )pbdoc",
+            py::return_value_policy::reference_internal, py::call_guard<py::gil_scoped_release>());
+
+    m.def("computeAsync", &gloss::computeAsync, R"pbdoc(
+        Starts compute() on the native thread pool and returns a ComputeHandle right away.
+    )pbdoc",
+        py::call_guard<py::gil_scoped_release>());
+
+    py::class_<CoverageMaps, std::shared_ptr<CoverageMaps>>(m, "CoverageMaps", R"pbdoc(
+        Coverage of all the antennas of a computation on the full DSM grid.
+    )pbdoc")
+        .def("getWidth", &CoverageMaps::getWidth)
+        .def("getHeight", &CoverageMaps::getHeight)
+        .def_property_readonly("geoTransform", [](const CoverageMaps& c) {
+            return std::vector<double>(c.getGeoTransform(), c.getGeoTransform() + 6);
+        })
+        .def("getLoSCount", [](py::object self) { return getCoverageArray(self, &CoverageMaps::getLoSCount); }, R"pbdoc(
+            Returns the number of antennas with LoS to each DSM pixel, a read-only height x width uint16 array.
+        )pbdoc")
+        .def("getBestAntenna", [](py::object self) { return getCoverageArray(self, &CoverageMaps::getBestAntenna); }, R"pbdoc(
+            Returns the id of the closest antenna with LoS to each DSM pixel, -1 where there is none, as int32.
+        )pbdoc")
+        .def("getBestDistance", [](py::object self) { return getCoverageArray(self, &CoverageMaps::getBestDistance); }, R"pbdoc(
+            Returns the distance in meters to the closest antenna with LoS, +inf where there is none, as float32.
+        )pbdoc")
+        .def("getMemoryUsage", &CoverageMaps::getMemoryUsage);
+
+    m.def("setCoverage", &gloss::setCoverage, R"pbdoc(
+        Folds every antenna of the next computations into CoverageMaps over the whole DSM: per pixel, the
+        number of antennas with LoS and the closest of them. Each LoSResult is dropped once folded in, so
+        memory stays O(raster) for any number of antennas, and compute() returns an empty dict unless
+        keep_results is True.
+    )pbdoc",
+        py::arg("enabled"), py::arg("keep_results") = false);
+
+    m.def("getCoverage", &gloss::getCoverage, R"pbdoc(
+        Returns the CoverageMaps of the last computation run with coverage on, or None.
     )pbdoc");
 
+    m.def("toGrid", &gloss::toGrid, R"pbdoc(
+        Expands a LoSResult to the legacy list of rays of ((lat, lon), elevation) samples.
+    )pbdoc",
+        py::arg("result"));
+
+    m.def("toHorizons", &gloss::toHorizons, R"pbdoc(
+        Summarizes each ray of a LoSResult as a list of (distance, LoSClass) transitions: the distance
+        in meters along the ray where the class changes, and the class from there on. Each list starts
+        with the class of the first sample. Only the codes are scanned, no sample coordinate is built.
+    )pbdoc",
+        py::arg("result"));
+
     m.def("saveResults", &gloss::saveResults, R"pbdoc(
-        Saves the computed LoS paths to JSON files.
+        Saves the computed LoS paths, one file per antenna (binary .glos by default, see setOutputFormat).
+    )pbdoc",
+        py::call_guard<py::gil_scoped_release>());
+
+    py::enum_<OutputFormat>(m, "OutputFormat")
+        .value("Binary", OutputFormat::Binary)
+        .value("Json", OutputFormat::Json)
+        .value("Horizons", OutputFormat::Horizons)
+        .value("GeoTiff", OutputFormat::GeoTiff);
+
+    m.def("setOutputFormat", &gloss::setOutputFormat, R"pbdoc(
+        Selects the format written by saveResults(). OutputFormat.Binary writes compact .glos
+        datasets (read them back with loadResults), OutputFormat.Json the legacy indented JSON,
+        OutputFormat.Horizons one los_horizons_<id>.json per antenna with the transitions of every
+        ray (see toHorizons), OutputFormat.GeoTiff one tiled, DEFLATE-compressed Byte GeoTIFF per
+        antenna on the DSM grid, with overviews.
+    )pbdoc",
+        py::arg("format"));
+
+    m.def("loadResults", &gloss::loadResults, R"pbdoc(
+        Reads .glos datasets written by saveResults(), from one file or from every one of a directory.
+        Returns a dict of antenna id to LoSResult.
+    )pbdoc",
+        py::arg("path"), py::call_guard<py::gil_scoped_release>());
+
+    py::enum_<TraversalMode>(m, "TraversalMode")
+        .value("LatLon", TraversalMode::LatLon)
+        .value("Pixel", TraversalMode::Pixel);
+
+    m.def("setTraversalMode", &gloss::setTraversalMode, R"pbdoc(
+        Selects how rays are sampled. TraversalMode.LatLon steps in degrees and projects every
+        sample; TraversalMode.Pixel projects each ray once and visits every crossed DSM pixel once.
+    )pbdoc",
+        py::arg("mode"));
+
+    py::enum_<LoSEngine>(m, "LoSEngine")
+        .value("Rays", LoSEngine::Rays)
+        .value("Viewshed", LoSEngine::Viewshed);
+
+    m.def("setEngine", &gloss::setEngine, R"pbdoc(
+        Selects how compute() classifies. LoSEngine.Rays samples one ray per degree; LoSEngine.Viewshed
+        classifies every DSM cell of the sector with a radial sweep and returns raster LoSResults.
+    )pbdoc",
+        py::arg("engine"));
+
+    m.def("setAngularRefinement", &gloss::setAngularRefinement, R"pbdoc(
+        Bisects neighbouring rays whose LoS profiles disagree over more than distance_threshold meters,
+        down to min_angle_step degrees, for sub-degree accuracy at LoS boundaries only.
+        A min_angle_step of 1 degree or more turns it off (the default).
+    )pbdoc",
+        py::arg("min_angle_step"), py::arg("distance_threshold") = 50.0);
+
+    m.def("getRayKernel", &gloss::getRayKernel, R"pbdoc(
+        Returns the instruction set used for pixel rays on in-memory rasters: "avx2", "sse2" or "scalar".
+        It is picked at load time unless forced with setRayKernel().
+    )pbdoc");
+
+    m.def("setRayKernel", &gloss::setRayKernel, R"pbdoc(
+        Forces the instruction set used for pixel rays: "avx2", "sse2", "scalar", or "auto" for the widest
+        one the CPU runs. All of them classify identically. Raises RuntimeError if the CPU can't run it.
+    )pbdoc",
+        py::arg("name"));
+
+    m.def("setNumThreads", &gloss::setNumThreads, R"pbdoc(
+        Sets the number of worker threads used by compute(). 0 uses one per hardware thread.
+        Raises RuntimeError while a computation, including one started by computeAsync(), is running.
+    )pbdoc",
+        py::arg("count"));
+
+    m.def("getNumThreads", &gloss::getNumThreads, R"pbdoc(
+        Returns the number of worker threads used by compute().
+    )pbdoc");
+
+    py::class_<TileCacheStats>(m, "TileCacheStats")
+        .def_readonly("hits", &TileCacheStats::hits)
+        .def_readonly("misses", &TileCacheStats::misses)
+        .def_readonly("evictions", &TileCacheStats::evictions)
+        .def_readonly("bytes_in_use", &TileCacheStats::bytesInUse)
+        .def_readonly("budget_bytes", &TileCacheStats::budgetBytes)
+        .def("__repr__", [](const TileCacheStats& s) {
+            return fmt::format("<TileCacheStats hits={} misses={} evictions={} bytes_in_use={} budget_bytes={}>",
+                               s.hits, s.misses, s.evictions, s.bytesInUse, s.budgetBytes);
+        });
+
+    m.def("setTileCacheSize", &gloss::setTileCacheSize, R"pbdoc(
+        Sets the byte budget of the DSM and ground raster block caches.
+    )pbdoc",
+        py::arg("budget_bytes"));
+
+    m.def("getCacheStats", &gloss::getCacheStats, R"pbdoc(
+        Returns the hit/miss/eviction counters of the "dsm" and "ground" block caches.
     )pbdoc");
 
+    m.def("convertToGlossDem", &convertToGlossDem, R"pbdoc(
+        Converts a GeoTIFF to the tiled, uncompressed .glossdem format. Passing .glossdem
+        files to initialize() maps them in memory instead of decoding them through GDAL.
+    )pbdoc",
+        py::arg("tiff_file"), py::arg("output_file"), py::arg("tile_size") = GLOSSDEM_DEFAULT_TILE_SIZE);
+
 #ifdef VERSION_INFO
     m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
 #else
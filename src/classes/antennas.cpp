@@ -1,4 +1,10 @@
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
 #include "../utils/json.hpp"
 #include "../utils/csvfile.cpp"
 
@@ -32,18 +38,68 @@ public:
 // Data position in the csv file
 enum fileFormat {LAT, LON, HGT, FRQ, ERP, NAME, AZ, DT, BW, BA, GNDELV};
 
-std::vector<Antenna> getAntennas(std::string filePath) {
-    // Read csv
-    csvFile* antFile = new csvFile(';', filePath);
-    
+// Number of a csv field, surrounded or not by blanks. Parsed as a float and widened, as with the
+// std::stof the antenna files were read with, so the same file gives the same antennas.
+double parseAntennaField(std::string_view field, const csvFile& file, const char* column) {
+    const char* begin = field.data();
+    const char* end = begin + field.size();
+    while (begin < end && (*begin == ' ' || *begin == '\t')) {
+        begin++;
+    }
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (end - begin > 1 && *begin == '+' && begin[1] != '-') {
+        begin++;
+    }
+    float value;
+    auto [stop, error] = std::from_chars(begin, end, value);
+    if (error != std::errc() || stop != end) {
+        throw std::runtime_error(file.getFilename() + ":" + std::to_string(file.getLineNumber()) + ": invalid " + column +
+                                 " \"" + std::string(field) + "\"");
+    }
+    return value;
+}
+
+// Antennas are built straight from the fields of the mapped file, no line is copied
+std::vector<Antenna> getAntennas(const std::string& filePath) {
+    csvFile antFile(';', filePath);
+
     std::vector<Antenna> AntennaList;
+    AntennaList.reserve(antFile.countLines());
+    std::vector<std::string_view> csvLine;
     int i = 1;
-    for (const auto& csvLine : (*antFile->getData())) {
-        Antenna ant(i++, std::stof(csvLine[LAT]), std::stof(csvLine[LON]), std::stof(csvLine[HGT]),
-                    std::stof(csvLine[FRQ]), std::stof(csvLine[ERP]), csvLine[NAME], std::stof(csvLine[AZ]),
-                    std::stof(csvLine[DT]), std::stof(csvLine[BW]), std::stof(csvLine[BA]), std::stof(csvLine[GNDELV]));
-        AntennaList.push_back(ant);
+    while (antFile.readLine(csvLine)) {
+        if (csvLine.size() <= GNDELV) {
+            throw std::runtime_error(antFile.getFilename() + ":" + std::to_string(antFile.getLineNumber()) + ": expected " +
+                                     std::to_string(GNDELV + 1) + " fields, got " + std::to_string(csvLine.size()));
+        }
+        AntennaList.emplace_back(i++, parseAntennaField(csvLine[LAT], antFile, "latitude"), parseAntennaField(csvLine[LON], antFile, "longitude"),
+                                 parseAntennaField(csvLine[HGT], antFile, "height"), parseAntennaField(csvLine[FRQ], antFile, "frequency"),
+                                 parseAntennaField(csvLine[ERP], antFile, "ERP"), std::string(csvLine[NAME]),
+                                 parseAntennaField(csvLine[AZ], antFile, "azimuth"), parseAntennaField(csvLine[DT], antFile, "downtilt"),
+                                 parseAntennaField(csvLine[BW], antFile, "bandwidth"), parseAntennaField(csvLine[BA], antFile, "BA"),
+                                 parseAntennaField(csvLine[GNDELV], antFile, "ground elevation"));
     }
 
     return AntennaList;
-}
\ No newline at end of file
+}
+
+// Groups the antennas sharing a mast: same position, height and ground elevation, so only
+// their sectors (azimuth, width, downtilt) differ. Groups keep the order of the file.
+std::vector<std::vector<int>> groupBySite(const std::vector<Antenna>& antennas) {
+    std::vector<std::vector<int>> sites;
+    std::map<std::tuple<double, double, double, double>, size_t> siteIndex;
+    for (size_t i = 0; i < antennas.size(); ++i) {
+        const Antenna& antenna = antennas[i];
+        auto key = std::make_tuple(antenna.lat, antenna.lon, antenna.height, antenna.gndElevation);
+        auto found = siteIndex.find(key);
+        if (found == siteIndex.end()) {
+            siteIndex[key] = sites.size();
+            sites.push_back({static_cast<int>(i)});
+        } else {
+            sites[found->second].push_back(static_cast<int>(i));
+        }
+    }
+    return sites;
+}
@@ -0,0 +1,79 @@
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// One bit per DSM pixel, set where the DSM stands more than the building height over the ground:
+// a LoS sample on that pixel is in a building. Blocks of the elevation pyramid also keep whether
+// any of their pixels is set, so whole runs of samples can be known to be outside buildings.
+class BuildingMask {
+public:
+    // isBuilding(line, row) fills row with the flags of the pixels of one DSM line
+    BuildingMask(int width, int height, const std::function<void(int, std::vector<uint8_t>&)>& isBuilding)
+        : width(width)
+        , height(height)
+        , bits((static_cast<size_t>(width) * height + 63) / 64, 0) {
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int level = 0; level < PYRAMID_LEVELS; ++level) {
+            levelWidth = (levelWidth + (1 << PYRAMID_SHIFT) - 1) >> PYRAMID_SHIFT;
+            levelHeight = (levelHeight + (1 << PYRAMID_SHIFT) - 1) >> PYRAMID_SHIFT;
+            blocks.push_back({levelWidth, std::vector<uint8_t>(static_cast<size_t>(levelWidth) * levelHeight, 0)});
+        }
+
+        std::vector<uint8_t> row(width);
+        for (int line = 0; line < height; ++line) {
+            isBuilding(line, row);
+            for (int pixel = 0; pixel < width; ++pixel) {
+                if (!row[pixel]) {
+                    continue;
+                }
+                size_t index = static_cast<size_t>(line) * width + pixel;
+                bits[index >> 6] |= uint64_t(1) << (index & 63);
+                for (int level = 0; level < PYRAMID_LEVELS; ++level) {
+                    int shift = PYRAMID_SHIFT * (level + 1);
+                    blocks[level].any[static_cast<size_t>(line >> shift) * blocks[level].width + (pixel >> shift)] = 1;
+                }
+            }
+        }
+    }
+
+    // Row-major index of a pixel inside the raster
+    bool isBuilding(size_t index) const {
+        return (bits[index >> 6] >> (index & 63)) & 1;
+    }
+
+    bool isBuilding(int pixel, int line) const {
+        return isBuilding(static_cast<size_t>(line) * width + pixel);
+    }
+
+    // Whether the pyramid block of a level holding a pixel may contain a building pixel. Blocks
+    // crossing the raster edge always may, as samples past the edge aren't in the mask.
+    bool blockHasBuildings(int level, int pixel, int line) const {
+        int shift = PYRAMID_SHIFT * (level + 1);
+        int blockX = pixel >> shift;
+        int blockY = line >> shift;
+        if (blockX < 0 || blockY < 0 || (blockX + 1) << shift > width || (blockY + 1) << shift > height) {
+            return true;
+        }
+        return blocks[level].any[static_cast<size_t>(blockY) * blocks[level].width + blockX] != 0;
+    }
+
+    size_t getMemoryUsage() const {
+        size_t bytes = bits.capacity() * sizeof(uint64_t);
+        for (const BlockLevel& level : blocks) {
+            bytes += level.any.capacity();
+        }
+        return bytes;
+    }
+
+private:
+    struct BlockLevel {
+        int width;
+        std::vector<uint8_t> any;
+    };
+
+    int width;
+    int height;
+    std::vector<uint64_t> bits;
+    std::vector<BlockLevel> blocks;
+};
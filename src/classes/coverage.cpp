@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const int COVERAGE_TILE_SHIFT = 8; // Coverage maps are locked by tiles of 2^shift x 2^shift DSM pixels
+
+// Visible DSM pixel of one antenna, with its distance to the antenna in meters
+struct CoverageHit {
+    uint32_t tile;
+    uint64_t index; // Row-major index of the pixel in the DSM
+    float distance;
+};
+
+// Aggregate coverage on the DSM grid: per pixel, the number of antennas seeing it and the antenna
+// seeing it from the shortest distance (ties go to the smallest id, so the maps don't depend on the
+// order antennas finish in). Antennas are folded in as they are computed and their results dropped,
+// so memory stays O(raster) however many antennas run. Each tile has its own lock, letting
+// concurrent antennas update distant parts of the maps in parallel.
+class CoverageMaps {
+public:
+    CoverageMaps(int width, int height, const double* geoTransform)
+        : width(width)
+        , height(height)
+        , tilesX((width + (1 << COVERAGE_TILE_SHIFT) - 1) >> COVERAGE_TILE_SHIFT)
+        , losCount(static_cast<size_t>(width) * height, 0)
+        , bestAntenna(static_cast<size_t>(width) * height, -1)
+        , bestDistance(static_cast<size_t>(width) * height, std::numeric_limits<float>::infinity()) {
+        std::copy(geoTransform, geoTransform + 6, this->geoTransform);
+        int tilesY = (height + (1 << COVERAGE_TILE_SHIFT) - 1) >> COVERAGE_TILE_SHIFT;
+        tileLocks.reset(new std::mutex[static_cast<size_t>(tilesX) * tilesY]);
+    }
+
+    CoverageHit makeHit(int pixel, int line, double distance) const {
+        uint32_t tile = static_cast<uint32_t>((line >> COVERAGE_TILE_SHIFT) * tilesX + (pixel >> COVERAGE_TILE_SHIFT));
+        return {tile, static_cast<uint64_t>(line) * width + pixel, static_cast<float>(distance)};
+    }
+
+    // Folds in the visible pixels of one antenna. A pixel may appear more than once (rays crossing
+    // the same pixel): it is counted once, at its shortest distance.
+    void addAntenna(int antennaId, std::vector<CoverageHit>& hits) {
+        std::sort(hits.begin(), hits.end(), [](const CoverageHit& a, const CoverageHit& b) {
+            if (a.tile != b.tile) {
+                return a.tile < b.tile;
+            }
+            return a.index != b.index ? a.index < b.index : a.distance < b.distance;
+        });
+
+        size_t i = 0;
+        while (i < hits.size()) {
+            uint32_t tile = hits[i].tile;
+            std::lock_guard<std::mutex> lock(tileLocks[tile]);
+            for (; i < hits.size() && hits[i].tile == tile; ++i) {
+                if (i > 0 && hits[i].index == hits[i - 1].index) {
+                    continue;
+                }
+                size_t index = hits[i].index;
+                if (losCount[index] < std::numeric_limits<uint16_t>::max()) {
+                    losCount[index]++;
+                }
+                float distance = hits[i].distance;
+                if (distance < bestDistance[index] || (distance == bestDistance[index] && antennaId < bestAntenna[index])) {
+                    bestDistance[index] = distance;
+                    bestAntenna[index] = antennaId;
+                }
+            }
+        }
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    const double* getGeoTransform() const {
+        return geoTransform;
+    }
+
+    // Row-major height x width maps. Read them once the computation is done.
+    const std::vector<uint16_t>& getLoSCount() const {
+        return losCount;
+    }
+
+    // -1 where no antenna has LoS
+    const std::vector<int32_t>& getBestAntenna() const {
+        return bestAntenna;
+    }
+
+    // Meters to the best antenna, +inf where no antenna has LoS
+    const std::vector<float>& getBestDistance() const {
+        return bestDistance;
+    }
+
+    size_t getMemoryUsage() const {
+        return losCount.capacity() * sizeof(uint16_t) + bestAntenna.capacity() * sizeof(int32_t) +
+               bestDistance.capacity() * sizeof(float);
+    }
+
+private:
+    int width;
+    int height;
+    int tilesX;
+    double geoTransform[6];
+    std::vector<uint16_t> losCount;
+    std::vector<int32_t> bestAntenna;
+    std::vector<float> bestDistance;
+    std::unique_ptr<std::mutex[]> tileLocks;
+};
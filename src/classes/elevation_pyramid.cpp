@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+const int PYRAMID_SHIFT = 3;  // Every level reduces 8x8 blocks of the level below
+const int PYRAMID_LEVELS = 3; // Blocks of 8, 64 and 512 pixels
+const int PYRAMID_CHUNK_ROWS = 1024; // Raster rows read at a time while building
+
+// Lowest and highest elevation of every 8x8, 64x64, ... block of a raster. Pixels without data
+// (NaN or the nodata value) count as both -infinity and +infinity, so no block holding one is
+// ever classified as a whole.
+class ElevationPyramid {
+public:
+    // readRows(firstLine, rowCount, buffer) fills buffer with rowCount full raster rows
+    ElevationPyramid(int width, int height, float noDataValue, const std::function<void(int, int, float*)>& readRows) {
+        const float infinity = std::numeric_limits<float>::infinity();
+        int levelWidth = width;
+        int levelHeight = height;
+        for (int level = 0; level < PYRAMID_LEVELS; ++level) {
+            levelWidth = (levelWidth + (1 << PYRAMID_SHIFT) - 1) >> PYRAMID_SHIFT;
+            levelHeight = (levelHeight + (1 << PYRAMID_SHIFT) - 1) >> PYRAMID_SHIFT;
+            size_t count = static_cast<size_t>(levelWidth) * levelHeight;
+            levels.push_back({levelWidth, levelHeight, std::vector<float>(count, infinity), std::vector<float>(count, -infinity)});
+        }
+
+        Level& base = levels[0];
+        std::vector<float> rows(static_cast<size_t>(width) * PYRAMID_CHUNK_ROWS);
+        for (int firstLine = 0; firstLine < height; firstLine += PYRAMID_CHUNK_ROWS) {
+            int rowCount = std::min(PYRAMID_CHUNK_ROWS, height - firstLine);
+            readRows(firstLine, rowCount, rows.data());
+            for (int row = 0; row < rowCount; ++row) {
+                const float* values = rows.data() + static_cast<size_t>(row) * width;
+                size_t blockRow = static_cast<size_t>((firstLine + row) >> PYRAMID_SHIFT) * base.width;
+                for (int pixel = 0; pixel < width; ++pixel) {
+                    float value = values[pixel];
+                    bool noData = std::isnan(value) || value == noDataValue;
+                    float low = noData ? -infinity : value;
+                    float high = noData ? infinity : value;
+                    size_t block = blockRow + (pixel >> PYRAMID_SHIFT);
+                    base.minimum[block] = std::min(base.minimum[block], low);
+                    base.maximum[block] = std::max(base.maximum[block], high);
+                }
+            }
+        }
+
+        for (size_t level = 1; level < levels.size(); ++level) {
+            const Level& below = levels[level - 1];
+            Level& current = levels[level];
+            for (int y = 0; y < below.height; ++y) {
+                for (int x = 0; x < below.width; ++x) {
+                    size_t block = static_cast<size_t>(y >> PYRAMID_SHIFT) * current.width + (x >> PYRAMID_SHIFT);
+                    size_t cell = static_cast<size_t>(y) * below.width + x;
+                    current.minimum[block] = std::min(current.minimum[block], below.minimum[cell]);
+                    current.maximum[block] = std::max(current.maximum[block], below.maximum[cell]);
+                }
+            }
+        }
+    }
+
+    int getNumLevels() const {
+        return static_cast<int>(levels.size());
+    }
+
+    // Log2 of the edge of the blocks of a level
+    int getBlockShift(int level) const {
+        return PYRAMID_SHIFT * (level + 1);
+    }
+
+    // Highest elevation of the block holding a pixel inside the raster
+    float getMax(int level, int pixel, int line) const {
+        const Level& current = levels[level];
+        int shift = getBlockShift(level);
+        return current.maximum[static_cast<size_t>(line >> shift) * current.width + (pixel >> shift)];
+    }
+
+    // Lowest elevation of the block holding a pixel inside the raster
+    float getMin(int level, int pixel, int line) const {
+        const Level& current = levels[level];
+        int shift = getBlockShift(level);
+        return current.minimum[static_cast<size_t>(line >> shift) * current.width + (pixel >> shift)];
+    }
+
+private:
+    struct Level {
+        int width;
+        int height;
+        std::vector<float> minimum;
+        std::vector<float> maximum;
+    };
+
+    std::vector<Level> levels;
+};
@@ -0,0 +1,253 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "gdal_priv.h"
+#include "ogr_spatialref.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// GLoSS-native elevation raster (.glossdem)
+//
+// Layout: GlossDemHeader, CRS as WKT, padding, then uncompressed float32 tiles.
+// Tiles are square (tileSize x tileSize), stored row-major, each one row-major inside.
+// Edge tiles are padded with the nodata value so every tile has the same size and
+// a pixel address is pure arithmetic. Tiles start on a page boundary so the file
+// can be mmapped and shared through the page cache by concurrent processes.
+
+const char GLOSSDEM_MAGIC[8] = {'G', 'L', 'O', 'S', 'S', 'D', 'E', 'M'};
+const uint32_t GLOSSDEM_VERSION = 1;
+const int GLOSSDEM_DEFAULT_TILE_SIZE = 256;
+const uint64_t GLOSSDEM_DATA_ALIGNMENT = 4096;
+const std::string GLOSSDEM_EXTENSION = ".glossdem";
+
+struct GlossDemHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tileSize;
+    int32_t width;
+    int32_t height;
+    double geoTransform[6];
+    double noData;
+    uint32_t hasNoData;
+    uint32_t wktLength;
+    uint64_t dataOffset;
+};
+
+bool isGlossDemFile(const std::string& filename) {
+    return filename.size() >= GLOSSDEM_EXTENSION.size() &&
+           filename.compare(filename.size() - GLOSSDEM_EXTENSION.size(), GLOSSDEM_EXTENSION.size(), GLOSSDEM_EXTENSION) == 0;
+}
+
+// Read-only memory mapping of a .glossdem file
+class MappedDem {
+public:
+    MappedDem(const std::string& filename) {
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Failed to open file.");
+        }
+        LARGE_INTEGER size;
+        GetFileSizeEx(fileHandle, &size);
+        mappedSize = static_cast<size_t>(size.QuadPart);
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            CloseHandle(fileHandle);
+            throw std::runtime_error("Failed to map file.");
+        }
+        base = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file.");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to stat file.");
+        }
+        mappedSize = static_cast<size_t>(info.st_size);
+        void* mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        base = mapping == MAP_FAILED ? nullptr : static_cast<const char*>(mapping);
+#endif
+        if (base == nullptr) {
+            unmap();
+            throw std::runtime_error("Failed to map file.");
+        }
+
+        if (mappedSize < sizeof(GlossDemHeader)) {
+            unmap();
+            throw std::runtime_error("Truncated .glossdem header.");
+        }
+        std::memcpy(&header, base, sizeof(GlossDemHeader));
+        if (std::memcmp(header.magic, GLOSSDEM_MAGIC, sizeof(GLOSSDEM_MAGIC)) != 0 || header.version != GLOSSDEM_VERSION) {
+            unmap();
+            throw std::runtime_error("Not a supported .glossdem file.");
+        }
+
+        if (header.tileSize == 0 || header.width <= 0 || header.height <= 0) {
+            unmap();
+            throw std::runtime_error("Invalid .glossdem dimensions.");
+        }
+        if (sizeof(GlossDemHeader) + static_cast<uint64_t>(header.wktLength) > header.dataOffset || header.dataOffset > mappedSize) {
+            unmap();
+            throw std::runtime_error("Truncated .glossdem header.");
+        }
+
+        uint64_t tileSize = header.tileSize;
+        tilesPerRow = static_cast<int>((header.width + tileSize - 1) / tileSize);
+        int tilesPerColumn = static_cast<int>((header.height + tileSize - 1) / tileSize);
+        uint64_t tileCount = static_cast<uint64_t>(tilesPerRow) * tilesPerColumn;
+        if (tileSize > mappedSize / tileSize / sizeof(float) ||
+            tileCount > (mappedSize - header.dataOffset) / (tileSize * tileSize * sizeof(float))) {
+            unmap();
+            throw std::runtime_error("Truncated .glossdem data.");
+        }
+
+        wkt.assign(base + sizeof(GlossDemHeader), header.wktLength);
+        tiles = reinterpret_cast<const float*>(base + header.dataOffset);
+    }
+
+    MappedDem(const MappedDem&) = delete;
+    MappedDem& operator=(const MappedDem&) = delete;
+
+    ~MappedDem() {
+        unmap();
+    }
+
+    float getElevationAtPixel(int pixel, int line) const {
+        uint32_t tileSize = header.tileSize;
+        size_t tile = static_cast<size_t>(line / tileSize) * tilesPerRow + pixel / tileSize;
+        return tiles[tile * tileSize * tileSize + (line % tileSize) * tileSize + (pixel % tileSize)];
+    }
+
+    // Copies full raster rows [line, line + rows) into a row-major buffer
+    void readRows(int line, int rows, float* dst) const {
+        uint32_t tileSize = header.tileSize;
+        size_t tilePixels = static_cast<size_t>(tileSize) * tileSize;
+        for (int row = 0; row < rows; ++row) {
+            int y = line + row;
+            const float* tileRow = tiles + static_cast<size_t>(y / tileSize) * tilesPerRow * tilePixels + (y % tileSize) * tileSize;
+            float* dstRow = dst + static_cast<size_t>(row) * header.width;
+            for (int tileX = 0; tileX < tilesPerRow; ++tileX) {
+                int count = std::min<int>(tileSize, header.width - tileX * tileSize);
+                std::copy_n(tileRow + tileX * tilePixels, count, dstRow + tileX * tileSize);
+            }
+        }
+    }
+
+    const GlossDemHeader& getHeader() const { return header; }
+    const std::string& getWkt() const { return wkt; }
+
+private:
+    void unmap() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap(const_cast<char*>(base), mappedSize);
+#endif
+        base = nullptr;
+    }
+
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#endif
+    const char* base = nullptr;
+    size_t mappedSize = 0;
+    GlossDemHeader header;
+    std::string wkt;
+    const float* tiles = nullptr;
+    int tilesPerRow = 0;
+};
+
+// Offline conversion of any GDAL-readable raster (band 1) to .glossdem
+void convertToGlossDem(const std::string& tiffFile, const std::string& outFile, int tileSize = GLOSSDEM_DEFAULT_TILE_SIZE) {
+    if (tileSize <= 0) {
+        throw std::invalid_argument("Tile size must be positive.");
+    }
+
+    GDALAllRegister();
+    GDALDataset* poDataset = (GDALDataset*)GDALOpen(tiffFile.c_str(), GA_ReadOnly);
+    if (poDataset == nullptr) {
+        throw std::runtime_error("Failed to open file.");
+    }
+    GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+
+    GlossDemHeader header = {};
+    std::memcpy(header.magic, GLOSSDEM_MAGIC, sizeof(GLOSSDEM_MAGIC));
+    header.version = GLOSSDEM_VERSION;
+    header.tileSize = static_cast<uint32_t>(tileSize);
+    header.width = poDataset->GetRasterXSize();
+    header.height = poDataset->GetRasterYSize();
+    if (poDataset->GetGeoTransform(header.geoTransform) != CE_None) {
+        GDALClose(poDataset);
+        throw std::runtime_error("Failed to get the geotransform.");
+    }
+    int hasNoData = 0;
+    header.noData = poBand->GetNoDataValue(&hasNoData);
+    header.hasNoData = hasNoData ? 1 : 0;
+    std::string wkt = poDataset->GetProjectionRef();
+    header.wktLength = static_cast<uint32_t>(wkt.size());
+    uint64_t headerBytes = sizeof(GlossDemHeader) + wkt.size();
+    header.dataOffset = (headerBytes + GLOSSDEM_DATA_ALIGNMENT - 1) / GLOSSDEM_DATA_ALIGNMENT * GLOSSDEM_DATA_ALIGNMENT;
+
+    std::ofstream out(outFile, std::ios::binary);
+    if (!out.is_open()) {
+        GDALClose(poDataset);
+        throw std::runtime_error("Could not open " + outFile + " for writing.");
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(GlossDemHeader));
+    out.write(wkt.data(), wkt.size());
+    std::vector<char> padding(header.dataOffset - headerBytes, 0);
+    out.write(padding.data(), padding.size());
+
+    // Convert one row of tiles at a time
+    float padValue = hasNoData ? static_cast<float>(header.noData) : 0.0f;
+    int tilesPerRow = (header.width + tileSize - 1) / tileSize;
+    std::vector<float> rows(static_cast<size_t>(header.width) * tileSize);
+    std::vector<float> tile(static_cast<size_t>(tileSize) * tileSize);
+    for (int yOff = 0; yOff < header.height; yOff += tileSize) {
+        int rowCount = std::min(tileSize, header.height - yOff);
+        CPLErr err = poBand->RasterIO(GF_Read, 0, yOff, header.width, rowCount, rows.data(),
+                                      header.width, rowCount, GDT_Float32, 0, 0);
+        if (err != CE_None) {
+            GDALClose(poDataset);
+            throw std::runtime_error("Failed to read raster rows.");
+        }
+
+        for (int tileX = 0; tileX < tilesPerRow; ++tileX) {
+            int xOff = tileX * tileSize;
+            int columnCount = std::min(tileSize, header.width - xOff);
+            std::fill(tile.begin(), tile.end(), padValue);
+            for (int row = 0; row < rowCount; ++row) {
+                std::copy_n(rows.begin() + static_cast<size_t>(row) * header.width + xOff, columnCount,
+                            tile.begin() + static_cast<size_t>(row) * tileSize);
+            }
+            out.write(reinterpret_cast<const char*>(tile.data()), tile.size() * sizeof(float));
+        }
+    }
+
+    GDALClose(poDataset);
+    if (!out.good()) {
+        throw std::runtime_error("Failed to write " + outFile + ".");
+    }
+    std::cout << "Converted " << tiffFile << " to " << outFile << std::endl;
+}
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "gdal_priv.h"
+#include "los_result.hpp"
+
+// Rasterized LoS dataset: one single-band Byte GeoTIFF per antenna, on the DSM grid (same CRS and
+// resolution) over the window of DSM pixels holding the result. Codes are the LoSClass values,
+// NoSample marking the pixels without any sample as nodata. Tiles are DEFLATE-compressed and the
+// file carries its own overviews, so GIS viewers open it without reading the full resolution.
+
+const int LOS_TIFF_BLOCK_SIZE = 256;
+const int LOS_TIFF_MIN_OVERVIEW_SIZE = 256; // Overviews are halved until both edges fit in this
+
+void writeLoSTiff(const std::string& filename, const gloss::RasterWindow& window, const uint8_t* codes, const std::string& wkt) {
+    if (window.width <= 0 || window.height <= 0) {
+        throw std::runtime_error("Nothing to rasterize for " + filename + ".");
+    }
+
+    GDALAllRegister();
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (driver == nullptr) {
+        throw std::runtime_error("GTiff driver not available.");
+    }
+
+    std::string blockSize = std::to_string(LOS_TIFF_BLOCK_SIZE);
+    char** options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", blockSize.c_str());
+    options = CSLSetNameValue(options, "BLOCKYSIZE", blockSize.c_str());
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    GDALDataset* dataset = driver->Create(filename.c_str(), window.width, window.height, 1, GDT_Byte, options);
+    CSLDestroy(options);
+    if (dataset == nullptr) {
+        throw std::runtime_error("Could not create " + filename + ".");
+    }
+
+    // Geotransform of the DSM moved to the first pixel of the window
+    const double* gt = window.geoTransform;
+    double geoTransform[6] = {gt[0] + window.xOff * gt[1] + window.yOff * gt[2], gt[1], gt[2],
+                              gt[3] + window.xOff * gt[4] + window.yOff * gt[5], gt[4], gt[5]};
+    dataset->SetGeoTransform(geoTransform);
+    dataset->SetProjection(wkt.c_str());
+
+    GDALRasterBand* band = dataset->GetRasterBand(1);
+    band->SetNoDataValue(static_cast<double>(gloss::LoSClass::NoSample));
+    CPLErr err = band->RasterIO(GF_Write, 0, 0, window.width, window.height, const_cast<uint8_t*>(codes),
+                                window.width, window.height, GDT_Byte, 0, 0);
+
+    // Halved until the smallest overview fits in LOS_TIFF_MIN_OVERVIEW_SIZE, nearest neighbour
+    // keeping them made of LoSClass codes
+    std::vector<int> levels;
+    for (int factor = 2; std::max(window.width, window.height) / (factor / 2) > LOS_TIFF_MIN_OVERVIEW_SIZE; factor *= 2) {
+        levels.push_back(factor);
+    }
+    if (err == CE_None && !levels.empty()) {
+        err = dataset->BuildOverviews("NEAREST", static_cast<int>(levels.size()), levels.data(), 0, nullptr, nullptr, nullptr);
+    }
+
+    GDALClose(dataset);
+    if (err != CE_None) {
+        throw std::runtime_error("Failed to write " + filename + ".");
+    }
+}
@@ -1,43 +1,91 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "gdal_priv.h"
 #include "ogr_spatialref.h"
+#include "glossdem.cpp"
+#include "tile_cache.cpp"
+#include "elevation_pyramid.cpp"
+
+const size_t DEFAULT_TILE_CACHE_BYTES = 256 * 1024 * 1024; // 256 MB per raster
+const int STRIP_TILE_SIZE = 256; // Tile edge used instead of the native block when the file is strip-organized
+const size_t RASTER_ALIGNMENT = 64; // Cache line alignment of in-memory rasters
+const int LOAD_CHUNK_ROWS = 1024; // Rows read per RasterIO call when loading a raster in memory
+const float NO_ELEVATION = std::numeric_limits<float>::quiet_NaN(); // Read outside the raster or on a pixel that can't be read
+
+// Allocates a contiguous float32 buffer aligned on RASTER_ALIGNMENT bytes
+inline std::shared_ptr<float> allocateAlignedRaster(size_t count) {
+    size_t bytes = (count * sizeof(float) + RASTER_ALIGNMENT - 1) / RASTER_ALIGNMENT * RASTER_ALIGNMENT;
+#ifdef _WIN32
+    float* data = static_cast<float*>(_aligned_malloc(bytes, RASTER_ALIGNMENT));
+    auto release = [](float* p) { _aligned_free(p); };
+#else
+    float* data = static_cast<float*>(std::aligned_alloc(RASTER_ALIGNMENT, bytes));
+    auto release = [](float* p) { std::free(p); };
+#endif
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+    return std::shared_ptr<float>(data, release);
+}
 
 class ElevationReader {
 public:
     ElevationReader() = default;
 
-    ElevationReader(std::string tiffFile) {
-        // Register all GDAL drivers
-        GDALAllRegister();
+    ElevationReader(std::string tiffFile, size_t cacheBudgetBytes = DEFAULT_TILE_CACHE_BYTES)
+        : filename(tiffFile)
+        , tileCache(std::make_shared<TileCache>(cacheBudgetBytes)) {
+        const char* pszSrcWKT = nullptr;
 
-        // Open the file
-        poDataset = (GDALDataset*)GDALOpen(tiffFile.c_str(), GA_ReadOnly);
-        if (poDataset == nullptr) {
-            throw std::runtime_error("Failed to open file.");
-        }
+        if (isGlossDemFile(tiffFile)) {
+            // Preprocessed raster: mapped directly, no GDAL dataset or decompression involved
+            mappedDem = std::make_shared<MappedDem>(tiffFile);
+            const GlossDemHeader& header = mappedDem->getHeader();
+            std::copy(std::begin(header.geoTransform), std::end(header.geoTransform), adfGeoTransform);
+            rasterXSize = header.width;
+            rasterYSize = header.height;
+            if (header.hasNoData) {
+                noDataValue = static_cast<float>(header.noData);
+            }
+            pszSrcWKT = mappedDem->getWkt().c_str();
+        } else {
+            openDataset();
+            pszSrcWKT = poDataset->GetProjectionRef();
 
-        // Initialize the raster band
-        poBand = poDataset->GetRasterBand(1);
-        if (poBand == nullptr) {
-            GDALClose(poDataset);
-            throw std::runtime_error("Failed to get the raster band.");
-        }
+            // Cache whole native blocks. Strip-organized files (one or a few rows per block)
+            // are cached as square tiles instead, so vertical rays don't thrash the cache.
+            poBand->GetBlockSize(&blockXSize, &blockYSize);
+            if (blockXSize >= poDataset->GetRasterXSize() && blockYSize < STRIP_TILE_SIZE) {
+                blockXSize = STRIP_TILE_SIZE;
+                blockYSize = STRIP_TILE_SIZE;
+            }
+            blocksPerRow = (poDataset->GetRasterXSize() + blockXSize - 1) / blockXSize;
+            rasterXSize = poDataset->GetRasterXSize();
+            rasterYSize = poDataset->GetRasterYSize();
 
-        // Get the geotransform
-        if (poDataset->GetGeoTransform(adfGeoTransform) != CE_None) {
-            GDALClose(poDataset);
-            throw std::runtime_error("Failed to get the geotransform.");
+            int hasNoData = 0;
+            double bandNoData = poBand->GetNoDataValue(&hasNoData);
+            if (hasNoData) {
+                noDataValue = static_cast<float>(bandNoData);
+            }
         }
 
         // Initialize the coordinate transformation
-        const char* pszSrcWKT = poDataset->GetProjectionRef();
         srcSRS.importFromEPSG(4326);  // WGS84
         dstSRS.importFromWkt(&pszSrcWKT);
         poCT = OGRCreateCoordinateTransformation(&srcSRS, &dstSRS);
         if (poCT == nullptr) {
-            GDALClose(poDataset);
+            if (poDataset) GDALClose(poDataset);
+            poDataset = nullptr;
             throw std::runtime_error("Failed to create coordinate transformation.");
         }
     }
@@ -45,42 +93,48 @@ public:
     ElevationReader(const ElevationReader&) = delete;
     ElevationReader& operator=(const ElevationReader&) = delete;
 
-    ElevationReader(ElevationReader&& other) noexcept
-        : poDataset(other.poDataset)
-        , poBand(other.poBand)
-        , srcSRS(std::move(other.srcSRS))
-        , dstSRS(std::move(other.dstSRS))
-        , poCT(other.poCT) 
-    {
-        std::copy(std::begin(other.adfGeoTransform), std::end(other.adfGeoTransform), std::begin(adfGeoTransform));
-        other.poDataset = nullptr;
-        other.poBand = nullptr;
-        other.poCT = nullptr;
+    ElevationReader(ElevationReader&& other) noexcept {
+        *this = std::move(other);
     }
 
     ElevationReader& operator=(ElevationReader&& other) noexcept {
         if (this != &other) {
             // Clean up existing resources
+            flushCacheStats();
             if (poCT) OCTDestroyCoordinateTransformation(poCT);
             if (poDataset) GDALClose(poDataset);
 
             // Transfer ownership
+            filename = std::move(other.filename);
             poDataset = other.poDataset;
             poBand = other.poBand;
             srcSRS = std::move(other.srcSRS);
             dstSRS = std::move(other.dstSRS);
             poCT = other.poCT;
             std::copy(std::begin(other.adfGeoTransform), std::end(other.adfGeoTransform), adfGeoTransform);
+            rasterXSize = other.rasterXSize;
+            rasterYSize = other.rasterYSize;
+            noDataValue = other.noDataValue;
+            blockXSize = other.blockXSize;
+            blockYSize = other.blockYSize;
+            blocksPerRow = other.blocksPerRow;
+            tileCache = std::move(other.tileCache);
+            lastTile = std::move(other.lastTile);
+            localHits = other.localHits;
+            memoryRaster = std::move(other.memoryRaster);
+            mappedDem = std::move(other.mappedDem);
 
             // Nullify source
             other.poDataset = nullptr;
             other.poBand = nullptr;
             other.poCT = nullptr;
+            other.localHits = 0;
         }
         return *this;
     }
 
     ~ElevationReader() {
+        flushCacheStats();
         if (poCT) {
             OCTDestroyCoordinateTransformation(poCT);
         }
@@ -89,44 +143,339 @@ public:
         }
     }
 
+    // Opens an independent handle on the same raster for another thread. GDAL datasets and
+    // coordinate transformations are not thread-safe; pixel data and the block cache are shared.
+    std::unique_ptr<ElevationReader> cloneForThread() const {
+        static std::mutex cloneMutex;
+        std::lock_guard<std::mutex> lock(cloneMutex);
+
+        std::unique_ptr<ElevationReader> clone(new ElevationReader());
+        if (poCT == nullptr) {
+            return clone; // Not opened yet
+        }
+
+        clone->filename = filename;
+        std::copy(std::begin(adfGeoTransform), std::end(adfGeoTransform), clone->adfGeoTransform);
+        clone->rasterXSize = rasterXSize;
+        clone->rasterYSize = rasterYSize;
+        clone->noDataValue = noDataValue;
+        clone->blockXSize = blockXSize;
+        clone->blockYSize = blockYSize;
+        clone->blocksPerRow = blocksPerRow;
+        clone->tileCache = tileCache;
+        clone->memoryRaster = memoryRaster;
+        clone->mappedDem = mappedDem;
+
+        // Only block reads go through GDAL
+        if (!memoryRaster && !mappedDem) {
+            clone->openDataset();
+        }
+
+        clone->srcSRS = srcSRS;
+        clone->dstSRS = dstSRS;
+        clone->poCT = OGRCreateCoordinateTransformation(&clone->srcSRS, &clone->dstSRS);
+        if (clone->poCT == nullptr) {
+            throw std::runtime_error("Failed to create coordinate transformation.");
+        }
+        return clone;
+    }
+
+    // Elevation at a WGS84 coordinate, NO_ELEVATION when it can't be projected or falls outside the raster
     float getElevation(double lat, double lon) {
+        int pixel, line;
+        if (!toPixel(lat, lon, pixel, line) || !containsPixel(pixel, line)) {
+            return NO_ELEVATION;
+        }
+
+        return getElevationAtPixel(pixel, line);
+    }
+
+    // Pixel/line read by getElevation for a WGS84 coordinate, possibly outside the raster
+    bool toPixel(double lat, double lon, int& pixel, int& line) {
         double x = lat;
         double y = lon;
 
         if (!poCT->Transform(1, &x, &y)) {
-            std::cout << "Failed to transform coordinates." << std::endl;
-            return -100.0;
-            //throw std::runtime_error("Failed to transform coordinates.");
+            return false;
         }
 
-        int pixel = static_cast<int>((x - adfGeoTransform[0]) / adfGeoTransform[1]);
-        int line = static_cast<int>((y - adfGeoTransform[3]) / adfGeoTransform[5]);
+        pixel = static_cast<int>((x - adfGeoTransform[0]) / adfGeoTransform[1]);
+        line = static_cast<int>((y - adfGeoTransform[3]) / adfGeoTransform[5]);
+        return true;
+    }
+
+    // Continuous pixel/line position of a WGS84 coordinate (pixel i covers [i, i + 1))
+    bool toPixelSpace(double lat, double lon, double& pixelX, double& lineY) {
+        double x = lat;
+        double y = lon;
 
-        if (pixel < 0 || pixel >= poDataset->GetRasterXSize() ||
-            line < 0 || line >= poDataset->GetRasterYSize()) {
-            std::cout << "Pixel/Line coordinates are out of bounds." << std::endl;
-            return -100.0;
-            //throw std::out_of_range("Pixel/Line coordinates are out of bounds.");
+        if (!poCT->Transform(1, &x, &y)) {
+            return false;
         }
 
-        float elevation = 0.0;
-        CPLErr err = poBand->RasterIO(GF_Read, pixel, line, 1, 1, &elevation, 1, 1, GDT_Float32, 0, 0);
+        pixelX = (x - adfGeoTransform[0]) / adfGeoTransform[1];
+        lineY = (y - adfGeoTransform[3]) / adfGeoTransform[5];
+        return true;
+    }
 
-        if (err != CE_None) {
-            std::cout << "Failed to read elevation value." << std::endl;
-            return -100.0;
-            //throw std::runtime_error("Failed to read elevation value.");
+    bool containsPixel(int pixel, int line) const {
+        return pixel >= 0 && pixel < rasterXSize && line >= 0 && line < rasterYSize;
+    }
+
+    int getWidth() const {
+        return rasterXSize;
+    }
+
+    int getHeight() const {
+        return rasterYSize;
+    }
+
+    const double* getGeoTransform() const {
+        return adfGeoTransform;
+    }
+
+    // CRS of the raster as WKT
+    std::string getWkt() const {
+        char* wkt = nullptr;
+        dstSRS.exportToWkt(&wkt);
+        std::string result = wkt ? wkt : "";
+        CPLFree(wkt);
+        return result;
+    }
+
+    // Value marking pixels without data: the one declared by the band, else -1 as the rasters
+    // used so far were written with
+    float getNoDataValue() const {
+        return noDataValue;
+    }
+
+    // Whether an elevation read from this raster is missing (nodata pixel, or NO_ELEVATION)
+    bool isNoData(float elevation) const {
+        return std::isnan(elevation) || elevation == noDataValue;
+    }
+
+    // Elevation of a pixel already known to be inside the raster, served from the block cache
+    float getElevationAtPixel(int pixel, int line) {
+        if (memoryRaster) {
+            return memoryRaster.get()[static_cast<size_t>(line) * rasterXSize + pixel];
+        }
+        if (mappedDem) {
+            return mappedDem->getElevationAtPixel(pixel, line);
+        }
+
+        int blockX = pixel / blockXSize;
+        int blockY = line / blockYSize;
+        uint64_t key = static_cast<uint64_t>(blockY) * blocksPerRow + blockX;
+
+        if (lastTile == nullptr || lastTile->key != key) {
+            flushCacheStats();
+            lastTile = fetchTile(key, blockX, blockY);
+            if (lastTile == nullptr) {
+                std::cout << "Failed to read elevation value." << std::endl;
+                return NO_ELEVATION;
+            }
+        } else {
+            localHits++;
+        }
+
+        return lastTile->data[(line - blockY * blockYSize) * lastTile->width + (pixel - blockX * blockXSize)];
+    }
+
+    // Reads the whole band once into a contiguous float32 array. Lookups then become
+    // plain indexed loads and the block cache is released.
+    void loadIntoMemory() {
+        if (memoryRaster) return;
+
+        size_t rowLength = static_cast<size_t>(rasterXSize);
+        std::shared_ptr<float> data = allocateAlignedRaster(rowLength * rasterYSize);
+        for (int line = 0; line < rasterYSize; line += LOAD_CHUNK_ROWS) {
+            int rows = std::min(LOAD_CHUNK_ROWS, rasterYSize - line);
+            if (mappedDem) {
+                mappedDem->readRows(line, rows, data.get() + line * rowLength);
+                continue;
+            }
+            CPLErr err = poBand->RasterIO(GF_Read, 0, line, rasterXSize, rows, data.get() + line * rowLength,
+                                          rasterXSize, rows, GDT_Float32, 0, 0);
+            if (err != CE_None) {
+                throw std::runtime_error("Failed to load raster in memory.");
+            }
         }
 
-        return elevation;
+        memoryRaster = std::move(data);
+        lastTile = nullptr;
+        tileCache->clear();
+    }
+
+    bool isInMemory() const {
+        return static_cast<bool>(memoryRaster);
+    }
+
+    // Row-major pixels of an in-memory raster, nullptr when it is read on demand
+    const float* getMemoryRaster() const {
+        return memoryRaster.get();
+    }
+
+    // Copies full raster rows [line, line + rows) into a row-major buffer
+    void readRows(int line, int rows, float* buffer) {
+        size_t rowLength = static_cast<size_t>(rasterXSize);
+        if (memoryRaster) {
+            std::copy_n(memoryRaster.get() + line * rowLength, rows * rowLength, buffer);
+        } else if (mappedDem) {
+            mappedDem->readRows(line, rows, buffer);
+        } else if (poBand->RasterIO(GF_Read, 0, line, rasterXSize, rows, buffer, rasterXSize, rows, GDT_Float32, 0, 0) != CE_None) {
+            throw std::runtime_error("Failed to read raster rows.");
+        }
+    }
+
+    // Elevations of this raster at the centers of the pixels of one line of another raster (nearest
+    // pixel, rounded as getElevation does), NO_ELEVATION where they fall outside. Same as readRows when both
+    // rasters share their grid.
+    void readResampled(const ElevationReader& grid, int line, float* buffer) {
+        if (hasSameGrid(grid)) {
+            readRows(line, 1, buffer);
+            return;
+        }
+
+        int width = grid.rasterXSize;
+        const double* gt = grid.adfGeoTransform;
+        std::vector<double> x(width), y(width);
+        for (int pixel = 0; pixel < width; ++pixel) {
+            x[pixel] = gt[0] + (pixel + 0.5) * gt[1] + (line + 0.5) * gt[2];
+            y[pixel] = gt[3] + (pixel + 0.5) * gt[4] + (line + 0.5) * gt[5];
+        }
+
+        std::vector<int> transformed(width, 1);
+        if (!dstSRS.IsSame(&grid.dstSRS)) {
+            OGRCoordinateTransformation* toThis = OGRCreateCoordinateTransformation(&grid.dstSRS, &dstSRS);
+            if (toThis == nullptr) {
+                throw std::runtime_error("Failed to create coordinate transformation.");
+            }
+            toThis->Transform(width, x.data(), y.data(), nullptr, transformed.data());
+            OCTDestroyCoordinateTransformation(toThis);
+        }
+
+        for (int pixel = 0; pixel < width; ++pixel) {
+            int thisPixel = static_cast<int>((x[pixel] - adfGeoTransform[0]) / adfGeoTransform[1]);
+            int thisLine = static_cast<int>((y[pixel] - adfGeoTransform[3]) / adfGeoTransform[5]);
+            buffer[pixel] = transformed[pixel] && containsPixel(thisPixel, thisLine) ? getElevationAtPixel(thisPixel, thisLine) : NO_ELEVATION;
+        }
+    }
+
+    // True for in-memory and .glossdem rasters, whose pixels are read straight from memory.
+    // A full pass over them is cheap, unlike over rasters read on demand through the tile cache.
+    bool isMemoryBacked() const {
+        return memoryRaster || mappedDem;
+    }
+
+    // Builds the min/max elevation pyramid of the raster. Only done for memory-backed rasters,
+    // null for rasters read on demand.
+    std::shared_ptr<const ElevationPyramid> buildPyramid() {
+        if (!isMemoryBacked()) return nullptr;
+
+        return std::make_shared<const ElevationPyramid>(rasterXSize, rasterYSize, noDataValue, [&](int line, int rows, float* buffer) {
+            readRows(line, rows, buffer);
+        });
+    }
+
+    // True when both rasters have the same pixels: same size, geotransform and CRS
+    bool hasSameGrid(const ElevationReader& other) const {
+        return rasterXSize == other.rasterXSize && rasterYSize == other.rasterYSize &&
+               std::equal(std::begin(adfGeoTransform), std::end(adfGeoTransform), std::begin(other.adfGeoTransform)) &&
+               dstSRS.IsSame(&other.dstSRS);
+    }
+
+    // Changes the byte budget of the block cache, evicting least recently used blocks if needed.
+    // The budget is shared by all the threads reading this raster.
+    void setCacheBudget(size_t budgetBytes) {
+        if (tileCache) tileCache->setBudget(budgetBytes);
+    }
+
+    TileCacheStats getCacheStats() const {
+        return tileCache ? tileCache->getStats() : TileCacheStats();
+    }
+
+    void resetCacheStats() {
+        if (tileCache) tileCache->resetStats();
+    }
+
+    // Publishes the hits served from the tile this handle holds to the shared counters
+    void flushCacheStats() {
+        if (localHits > 0 && tileCache) {
+            tileCache->addHits(localHits);
+        }
+        localHits = 0;
     }
 
 private:
+    void openDataset() {
+        // Register all GDAL drivers
+        GDALAllRegister();
+
+        // Open the file
+        poDataset = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
+        if (poDataset == nullptr) {
+            throw std::runtime_error("Failed to open file.");
+        }
+
+        // Initialize the raster band
+        poBand = poDataset->GetRasterBand(1);
+        if (poBand == nullptr) {
+            GDALClose(poDataset);
+            poDataset = nullptr;
+            throw std::runtime_error("Failed to get the raster band.");
+        }
+
+        // Get the geotransform
+        if (poDataset->GetGeoTransform(adfGeoTransform) != CE_None) {
+            GDALClose(poDataset);
+            poDataset = nullptr;
+            throw std::runtime_error("Failed to get the geotransform.");
+        }
+    }
+
+    // Returns the tile from the shared cache, reading the whole block through this handle's dataset on a miss
+    std::shared_ptr<const CachedTile> fetchTile(uint64_t key, int blockX, int blockY) {
+        std::shared_ptr<const CachedTile> cached = tileCache->find(key);
+        if (cached) {
+            return cached;
+        }
+
+        int xOff = blockX * blockXSize;
+        int yOff = blockY * blockYSize;
+        int width = std::min(blockXSize, rasterXSize - xOff);
+        int height = std::min(blockYSize, rasterYSize - yOff);
+
+        auto tile = std::make_shared<CachedTile>(CachedTile{key, width, height, std::vector<float>(static_cast<size_t>(width) * height)});
+        CPLErr err = poBand->RasterIO(GF_Read, xOff, yOff, width, height, tile->data.data(), width, height, GDT_Float32, 0, 0);
+        if (err != CE_None) {
+            return nullptr;
+        }
+
+        return tileCache->insert(tile);
+    }
+
+    std::string filename;
     GDALDataset* poDataset = nullptr;
     GDALRasterBand* poBand = nullptr;
     OGRSpatialReference srcSRS, dstSRS;
     OGRCoordinateTransformation* poCT = nullptr;
     double adfGeoTransform[6];
+    int rasterXSize = 0;
+    int rasterYSize = 0;
+    float noDataValue = -1.0f;
+
+    // Block cache, shared with the handles cloned for other threads
+    int blockXSize = 1;
+    int blockYSize = 1;
+    int blocksPerRow = 1;
+    std::shared_ptr<TileCache> tileCache;
+    std::shared_ptr<const CachedTile> lastTile; // Tile of the previous lookup, read without locking
+    uint64_t localHits = 0;
+
+    // Whole band as row-major float32, set by loadIntoMemory()
+    std::shared_ptr<float> memoryRaster;
+    // Set when the raster is a .glossdem file
+    std::shared_ptr<MappedDem> mappedDem;
 };
 
 // int main() {
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#include "los_result.hpp"
+
+// Binary LoS dataset (.glos), one file per antenna
+//
+// Layout: LoSFileHeader, numRays LoSFileRay records, then the rays x stride class codes
+// (one byte per sample, rows padded with LoSClass::NoSample). Values are in native byte
+// order. Coordinates are not stored, they are rebuilt from the origin and the rays.
+//
+// Version 2 adds a LoSFileLayout record right after the unchanged version 1 header.
+// Raster (viewshed) datasets have a LoSFileRaster record instead of the rays, followed
+// by the height x width codes. Version 1 datasets are always ray datasets.
+
+const char LOS_FILE_MAGIC[8] = {'G', 'L', 'O', 'S', 'S', 'L', 'O', 'S'};
+const uint32_t LOS_FILE_VERSION = 2;
+const std::string LOS_FILE_EXTENSION = ".glos";
+const size_t LOS_FILE_BUFFER_BYTES = 1 << 20;
+
+struct LoSFileHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t antennaId;
+    double originLat;
+    double originLon;
+    uint32_t numRays;
+    uint32_t stride;
+};
+
+struct LoSFileLayout {
+    uint32_t raster;
+    uint32_t reserved;
+};
+
+struct LoSFileRaster {
+    int32_t xOff;
+    int32_t yOff;
+    int32_t width;
+    int32_t height;
+    double geoTransform[6];
+};
+
+struct LoSFileRay {
+    double bearing;
+    double endLat;
+    double endLon;
+    double startPx;
+    double startPy;
+    double endPx;
+    double endPy;
+    int32_t numSamples;
+    uint32_t pixelSpace;
+};
+
+void writeLoSFile(const std::string& filename, int antennaId, const gloss::LoSResult& result) {
+    std::vector<char> buffer(LOS_FILE_BUFFER_BYTES);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open " + filename + " for writing.");
+    }
+
+    LoSFileHeader header = {};
+    std::memcpy(header.magic, LOS_FILE_MAGIC, sizeof(LOS_FILE_MAGIC));
+    header.version = LOS_FILE_VERSION;
+    header.antennaId = antennaId;
+    header.originLat = result.getOrigin().first;
+    header.originLon = result.getOrigin().second;
+    header.numRays = static_cast<uint32_t>(result.getNumRays());
+    header.stride = static_cast<uint32_t>(result.getStride());
+    out.write(reinterpret_cast<const char*>(&header), sizeof(LoSFileHeader));
+
+    LoSFileLayout layout = {};
+    layout.raster = result.isRaster() ? 1u : 0u;
+    out.write(reinterpret_cast<const char*>(&layout), sizeof(LoSFileLayout));
+
+    if (result.isRaster()) {
+        const gloss::RasterWindow& window = result.getRasterWindow();
+        LoSFileRaster record = {window.xOff, window.yOff, window.width, window.height, {}};
+        std::memcpy(record.geoTransform, window.geoTransform, sizeof(record.geoTransform));
+        out.write(reinterpret_cast<const char*>(&record), sizeof(LoSFileRaster));
+    }
+
+    for (size_t i = 0; i < result.getNumRays(); ++i) {
+        const gloss::RayGeometry& ray = result.getRay(i);
+        LoSFileRay record = {ray.bearing, ray.end.first, ray.end.second, ray.startPx, ray.startPy,
+                             ray.endPx, ray.endPy, ray.numSamples, ray.pixelSpace ? 1u : 0u};
+        out.write(reinterpret_cast<const char*>(&record), sizeof(LoSFileRay));
+    }
+
+    const std::vector<uint8_t>& codes = result.getCodes();
+    out.write(reinterpret_cast<const char*>(codes.data()), codes.size());
+
+    out.close();
+    if (out.fail()) {
+        throw std::runtime_error("Failed to write " + filename + ".");
+    }
+}
+
+gloss::LoSResult readLoSFile(const std::string& filename, int* antennaId = nullptr) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Failed to open file.");
+    }
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    LoSFileHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(LoSFileHeader));
+    if (!in || std::memcmp(header.magic, LOS_FILE_MAGIC, sizeof(LOS_FILE_MAGIC)) != 0) {
+        throw std::runtime_error(filename + " is not a GLoSS LoS dataset.");
+    }
+    if (header.version != 1 && header.version != LOS_FILE_VERSION) {
+        throw std::runtime_error("Unsupported LoS dataset version " + std::to_string(header.version) + ".");
+    }
+
+    LoSFileLayout layout = {};
+    if (header.version >= 2) {
+        in.read(reinterpret_cast<char*>(&layout), sizeof(LoSFileLayout));
+        if (!in) {
+            throw std::runtime_error(filename + " is truncated.");
+        }
+    }
+
+    if (layout.raster != 0) {
+        LoSFileRaster record;
+        in.read(reinterpret_cast<char*>(&record), sizeof(LoSFileRaster));
+        if (!in || record.width < 0 || record.height < 0 || static_cast<uint32_t>(record.width) != header.stride) {
+            throw std::runtime_error(filename + " is corrupted.");
+        }
+        // Checked before the codes are allocated
+        if (static_cast<uint64_t>(record.width) * record.height > fileSize - static_cast<uint64_t>(in.tellg())) {
+            throw std::runtime_error(filename + " is truncated.");
+        }
+        gloss::RasterWindow window;
+        window.xOff = record.xOff;
+        window.yOff = record.yOff;
+        window.width = record.width;
+        window.height = record.height;
+        std::memcpy(window.geoTransform, record.geoTransform, sizeof(window.geoTransform));
+
+        gloss::LoSResult result({header.originLat, header.originLon}, window);
+        in.read(reinterpret_cast<char*>(result.getRowCodes(0)), result.getNumRows() * result.getStride());
+        if (!in) {
+            throw std::runtime_error(filename + " is truncated.");
+        }
+        if (antennaId != nullptr) {
+            *antennaId = header.antennaId;
+        }
+        return result;
+    }
+
+    // Checked before the rays and codes are allocated
+    if (static_cast<uint64_t>(header.numRays) * (sizeof(LoSFileRay) + header.stride) > fileSize - static_cast<uint64_t>(in.tellg())) {
+        throw std::runtime_error(filename + " is truncated.");
+    }
+
+    std::vector<gloss::RayGeometry> rays(header.numRays);
+    for (gloss::RayGeometry& ray : rays) {
+        LoSFileRay record;
+        in.read(reinterpret_cast<char*>(&record), sizeof(LoSFileRay));
+        ray.bearing = record.bearing;
+        ray.end = {record.endLat, record.endLon};
+        ray.numSamples = record.numSamples;
+        ray.pixelSpace = record.pixelSpace != 0;
+        ray.startPx = record.startPx;
+        ray.startPy = record.startPy;
+        ray.endPx = record.endPx;
+        ray.endPy = record.endPy;
+    }
+
+    gloss::LoSResult result({header.originLat, header.originLon}, std::move(rays));
+    if (result.getStride() != header.stride) {
+        throw std::runtime_error(filename + " is corrupted.");
+    }
+    in.read(reinterpret_cast<char*>(result.getRayCodes(0)), result.getNumRays() * result.getStride());
+    if (!in) {
+        throw std::runtime_error(filename + " is truncated.");
+    }
+
+    if (antennaId != nullptr) {
+        *antennaId = header.antennaId;
+    }
+    return result;
+}
+
+// Reads every .glos dataset of a directory, keyed by antenna id
+std::map<int, gloss::LoSResult> readLoSDirectory(const std::string& directory) {
+    std::map<int, gloss::LoSResult> results;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.is_regular_file() && entry.path().extension() == LOS_FILE_EXTENSION) {
+            int antennaId = 0;
+            gloss::LoSResult result = readLoSFile(entry.path().string(), &antennaId);
+            results[antennaId] = std::move(result);
+        }
+    }
+    return results;
+}
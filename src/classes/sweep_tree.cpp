@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Cells crossed by the sweep line of the viewshed engine, with the steepest slopes in front of a
+// target. All the cells of a slice are known before it is swept, so the balanced tree keyed by
+// distance is a segment tree over their distance ranks: cells enter and leave by rank and the
+// cells in front of a target are a prefix of the ranks, each in O(log n).
+class SweepTree {
+public:
+    struct Slopes {
+        float obstacle; // Slope from the antenna to the top of the cell
+        float ue;       // Slope from the antenna to a UE standing on the cell
+    };
+
+    // Empties the tree and sizes it for count ranks
+    void reset(size_t count) {
+        leaves = 1;
+        while (leaves < count) {
+            leaves <<= 1;
+        }
+        nodes.assign(2 * leaves, empty());
+    }
+
+    void insert(size_t rank, float obstacleSlope, float ueSlope) {
+        size_t node = leaves + rank;
+        nodes[node] = {obstacleSlope, ueSlope};
+        update(node);
+    }
+
+    void erase(size_t rank) {
+        size_t node = leaves + rank;
+        nodes[node] = empty();
+        update(node);
+    }
+
+    // Steepest slopes among the cells ranked before end, -infinity when there is none
+    Slopes maxBefore(size_t end) const {
+        Slopes result = empty();
+        for (size_t left = leaves, right = leaves + end; left < right; left >>= 1, right >>= 1) {
+            if (left & 1) {
+                merge(result, nodes[left++]);
+            }
+            if (right & 1) {
+                merge(result, nodes[--right]);
+            }
+        }
+        return result;
+    }
+
+private:
+    static Slopes empty() {
+        return {-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+    }
+
+    static void merge(Slopes& into, const Slopes& other) {
+        into.obstacle = std::max(into.obstacle, other.obstacle);
+        into.ue = std::max(into.ue, other.ue);
+    }
+
+    void update(size_t node) {
+        for (node >>= 1; node > 0; node >>= 1) {
+            Slopes slopes = nodes[2 * node];
+            merge(slopes, nodes[2 * node + 1]);
+            nodes[node] = slopes;
+        }
+    }
+
+    size_t leaves = 1;
+    std::vector<Slopes> nodes;
+};
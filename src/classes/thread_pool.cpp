@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing pool. Every worker owns a deque: tasks it submits go to the back
+// of its own deque and are popped LIFO, idle workers steal the oldest task at the front of
+// the others'. Tasks submitted from outside the pool go through a shared FIFO queue.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t numThreads) {
+        numThreads = std::max<size_t>(numThreads, 1);
+        for (size_t i = 0; i < numThreads; ++i) {
+            queues.push_back(std::make_unique<TaskQueue>());
+        }
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Finishes the queued tasks, then joins the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        TaskQueue& queue = currentPool == this ? *queues[currentIndex] : injected;
+        {
+            // Counted under the queue lock, so a pop can never decrement before the increment
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queued++;
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            // A worker between its check of queued and its wait holds sleepMutex: taking it
+            // here ensures the notification cannot be lost
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_one();
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Runs one queued task on a worker: its own newest task first, then the oldest
+    // submitted from outside, then one stolen from another worker.
+    bool runPendingTask() {
+        std::function<void()> task;
+        bool isWorker = currentPool == this;
+        if ((isWorker && popBack(*queues[currentIndex], task)) || popFront(injected, task)) {
+            task();
+            return true;
+        }
+
+        size_t start = isWorker ? currentIndex + 1 : 0;
+        for (size_t i = 0; i < queues.size(); ++i) {
+            if (popFront(*queues[(start + i) % queues.size()], task)) {
+                task();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool popBack(TaskQueue& queue, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool popFront(TaskQueue& queue, std::function<void()>& task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        queued--;
+        return true;
+    }
+
+    void workerLoop(size_t index) {
+        currentPool = this;
+        currentIndex = index;
+        while (true) {
+            if (runPendingTask()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+
+    inline static thread_local ThreadPool* currentPool = nullptr;
+    inline static thread_local size_t currentIndex = 0;
+
+    std::vector<std::unique_ptr<TaskQueue>> queues; // One per worker
+    TaskQueue injected;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+};
+
+// Tasks that can be waited on together. The tasks are kept in the group's own queue and the
+// pool only receives tickets, each running the next task of its group. wait() runs the
+// group's remaining tasks on the calling thread and never picks up unrelated pool work, so a
+// task can split its work in a nested group (an antenna waiting for its rays) without
+// nesting other antennas on its stack. The first exception thrown by a task is rethrown by
+// wait().
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool(pool), state(std::make_shared<State>()) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    void run(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->pending++;
+            state->tasks.push_back(std::move(task));
+        }
+        state->changed.notify_all();
+        // Tickets left over once wait() ran their task find the queue empty and do nothing
+        pool.submit([state = state] { runNext(*state); });
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (state->pending > 0) {
+            if (!state->tasks.empty()) {
+                lock.unlock();
+                runNext(*state);
+                lock.lock();
+                continue;
+            }
+            // The remaining tasks are running on other threads
+            state->changed.wait(lock, [this] { return state->pending == 0 || !state->tasks.empty(); });
+        }
+
+        if (state->error) {
+            std::exception_ptr thrown = state->error;
+            state->error = nullptr;
+            std::rethrow_exception(thrown);
+        }
+    }
+
+private:
+    // Shared with the tickets, which can outlive the group
+    struct State {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::function<void()>> tasks;
+        size_t pending = 0;
+        std::exception_ptr error;
+    };
+
+    static void runNext(State& state) {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.tasks.empty()) return;
+            task = std::move(state.tasks.front());
+            state.tasks.pop_front();
+        }
+
+        std::exception_ptr thrown;
+        try {
+            task();
+        } catch (...) {
+            thrown = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (thrown && !state.error) state.error = thrown;
+            state.pending--;
+        }
+        state.changed.notify_all();
+    }
+
+    ThreadPool& pool;
+    std::shared_ptr<State> state;
+};
+
+// Default worker count, one per hardware thread
+size_t DefaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+size_t numThreads = DefaultThreadCount();
+std::unique_ptr<ThreadPool> threadPool;
+std::mutex threadPoolMutex;
+size_t activeComputations = 0; // Guarded by threadPoolMutex
+
+ThreadPool& GetThreadPool() {
+    std::lock_guard<std::mutex> lock(threadPoolMutex);
+    if (!threadPool) {
+        threadPool = std::make_unique<ThreadPool>(numThreads);
+    }
+    return *threadPool;
+}
+
+// Held by every running computation, from before its first task is submitted until its
+// last one has finished. The pool cannot be resized while any is held.
+class ThreadPoolUse {
+public:
+    ThreadPoolUse() {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        activeComputations++;
+    }
+
+    ~ThreadPoolUse() {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        activeComputations--;
+    }
+
+    ThreadPoolUse(const ThreadPoolUse&) = delete;
+    ThreadPoolUse& operator=(const ThreadPoolUse&) = delete;
+};
+
+// Resizing recreates the pool, so it is refused while a computation is running
+void SetThreadPoolSize(size_t count) {
+    std::lock_guard<std::mutex> lock(threadPoolMutex);
+    if (activeComputations > 0) {
+        throw std::runtime_error("Cannot change the number of threads while a computation is running.");
+    }
+    if (count != numThreads) {
+        numThreads = count;
+        threadPool.reset();
+    }
+}
+
+// Held while a setting read by computations changes, so that none starts meanwhile. Settings are
+// read throughout a computation, so they are refused while one is running.
+std::unique_lock<std::mutex> LockSettings() {
+    std::unique_lock<std::mutex> lock(threadPoolMutex);
+    if (activeComputations > 0) {
+        throw std::runtime_error("Cannot change settings while a computation is running.");
+    }
+    return lock;
+}
@@ -0,0 +1,145 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+const int TILE_CACHE_SHARDS = 16; // Independently locked parts of the cache
+
+// Counters of the block cache, used to size the byte budget for a given raster
+struct TileCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bytesInUse = 0;
+    size_t budgetBytes = 0;
+};
+
+struct CachedTile {
+    uint64_t key;
+    int width;
+    int height;
+    std::vector<float> data;
+};
+
+// LRU block cache shared by every handle opened on the same raster.
+// Blocks are spread over shards with their own lock so worker threads rarely contend,
+// and tiles are reference counted so one evicted while still in use stays valid.
+class TileCache {
+public:
+    explicit TileCache(size_t budgetBytes) {
+        setBudget(budgetBytes);
+    }
+
+    std::shared_ptr<const CachedTile> find(uint64_t key) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(key);
+        if (found == shard.index.end()) {
+            misses++;
+            return nullptr;
+        }
+
+        hits++;
+        shard.tiles.splice(shard.tiles.begin(), shard.tiles, found->second);
+        return shard.tiles.front();
+    }
+
+    // Adds a block read after a miss. If another thread cached it meanwhile, its copy is returned.
+    std::shared_ptr<const CachedTile> insert(std::shared_ptr<const CachedTile> tile) {
+        Shard& shard = shardFor(tile->key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.index.find(tile->key);
+        if (found != shard.index.end()) {
+            return *found->second;
+        }
+
+        size_t bytes = tile->data.size() * sizeof(float);
+        evict(shard, bytes);
+        shard.tiles.push_front(tile);
+        shard.index[tile->key] = shard.tiles.begin();
+        shard.bytesInUse += bytes;
+        bytesInUse += bytes;
+        return tile;
+    }
+
+    // Hits served by a handle from the tile it already holds
+    void addHits(uint64_t count) {
+        hits += count;
+    }
+
+    // Changes the total byte budget, evicting least recently used blocks if needed
+    void setBudget(size_t budgetBytes) {
+        budget = budgetBytes;
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            evict(shard, 0);
+        }
+    }
+
+    void clear() {
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            bytesInUse -= shard.bytesInUse;
+            shard.bytesInUse = 0;
+            shard.tiles.clear();
+            shard.index.clear();
+        }
+    }
+
+    TileCacheStats getStats() const {
+        TileCacheStats stats;
+        stats.hits = hits;
+        stats.misses = misses;
+        stats.evictions = evictions;
+        stats.bytesInUse = bytesInUse;
+        stats.budgetBytes = budget;
+        return stats;
+    }
+
+    void resetStats() {
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::shared_ptr<const CachedTile>> tiles; // Most recently used first
+        std::unordered_map<uint64_t, std::list<std::shared_ptr<const CachedTile>>::iterator> index;
+        size_t bytesInUse = 0;
+    };
+
+    Shard& shardFor(uint64_t key) {
+        return shards[key % TILE_CACHE_SHARDS];
+    }
+
+    // Evicts least recently used tiles of the shard until incomingBytes fits in its share of
+    // the budget. A budget smaller than one tile degrades to keeping one tile per shard.
+    void evict(Shard& shard, size_t incomingBytes) {
+        size_t shardBudget = budget / TILE_CACHE_SHARDS;
+        size_t keep = incomingBytes > 0 ? 0 : 1;
+        while (shard.tiles.size() > keep && shard.bytesInUse + incomingBytes > shardBudget) {
+            const CachedTile& victim = *shard.tiles.back();
+            size_t bytes = victim.data.size() * sizeof(float);
+            shard.bytesInUse -= bytes;
+            bytesInUse -= bytes;
+            evictions++;
+            shard.index.erase(victim.key);
+            shard.tiles.pop_back();
+        }
+    }
+
+    std::array<Shard, TILE_CACHE_SHARDS> shards;
+    std::atomic<size_t> budget{0};
+    std::atomic<size_t> bytesInUse{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
@@ -5,16 +5,13 @@
 #include <memory>
 #include <map>
 #include <random>
+#include <atomic>
+#include <mutex>
 
+#include "../include/gloss.hpp"
 #include "classes/antennas.cpp"
 #include "classes/read_tiff.cpp"
-
-
-using Coordinate = std::pair<double, double>;
-using Elevation = float;
-using CoordinateElevationPair = std::pair<Coordinate, Elevation>;
-using Grid = std::vector<std::vector<CoordinateElevationPair>>;
-using AntennaDict = std::map<int, Grid>;
+#include "classes/building_mask.cpp"
 
 
 // For testing purposes
@@ -35,6 +32,40 @@ const char* groundTiffFile;
 
 ElevationReader reader;
 ElevationReader groundReader;
+std::shared_ptr<const ElevationPyramid> dsmPyramid;
+std::shared_ptr<const BuildingMask> buildingMask;
+
+// Per-thread handles on reader and groundReader. GDAL datasets and OGR transformations can't be
+// shared between threads, so every thread computing LoS works on its own clones (pixel data and
+// block caches stay shared). The generation invalidates clones when initializeReaders() runs again.
+struct ThreadReaders {
+    int generation = -1;
+    std::unique_ptr<ElevationReader> dsm;
+    std::unique_ptr<ElevationReader> ground;
+};
+
+std::atomic<int> readerGeneration{0};
+thread_local ThreadReaders threadReaders;
+
+ThreadReaders& GetThreadReaders() {
+    int generation = readerGeneration.load(std::memory_order_acquire);
+    if (threadReaders.generation != generation) {
+        threadReaders.dsm = reader.cloneForThread();
+        threadReaders.ground = groundReader.cloneForThread();
+        threadReaders.generation = generation;
+    }
+    return threadReaders;
+}
+
+ElevationReader& DsmReader() {
+    return *GetThreadReaders().dsm;
+}
+
+ElevationReader& GroundReader() {
+    return *GetThreadReaders().ground;
+}
+
+size_t tileCacheBudget = DEFAULT_TILE_CACHE_BYTES;
 
 void setTiffFile(const char* filename) {
     tiffFile = filename;
@@ -44,10 +75,78 @@ void setGroundTiffFile(const char* filename) {
     groundTiffFile = filename;
 }
 
-void initializeReaders() {
+void setTileCacheBudget(size_t budgetBytes) {
+    tileCacheBudget = budgetBytes;
+    reader.setCacheBudget(budgetBytes);
+    groundReader.setCacheBudget(budgetBytes);
+}
+
+void initializeReaders(bool inMemory) {
     std::cout << "Initializing readers with files: " << tiffFile << " and " << groundTiffFile << std::endl;
-    reader = ElevationReader(tiffFile);
-    groundReader = ElevationReader(groundTiffFile);
+    reader = ElevationReader(tiffFile, tileCacheBudget);
+    groundReader = ElevationReader(groundTiffFile, tileCacheBudget);
+
+    if (inMemory) {
+        std::cout << "Loading rasters in memory" << std::endl;
+        reader.loadIntoMemory();
+        groundReader.loadIntoMemory();
+    }
+
+    std::atomic_store(&dsmPyramid, std::shared_ptr<const ElevationPyramid>());
+    std::atomic_store(&buildingMask, std::shared_ptr<const BuildingMask>());
+
+    readerGeneration++;
+}
+
+// Min/max pyramid of the DSM, set by buildDsmPyramid()
+const ElevationPyramid* GetDsmPyramid() {
+    return std::atomic_load(&dsmPyramid).get();
+}
+
+// Builds the DSM pyramid once per initializeReaders(), on the first computation walking it rather
+// than at startup: it reads the whole DSM, which a mapped .glossdem otherwise never does.
+void buildDsmPyramid() {
+    static std::mutex buildMutex;
+    std::lock_guard<std::mutex> lock(buildMutex);
+    if (std::atomic_load(&dsmPyramid) || !reader.isMemoryBacked()) {
+        return;
+    }
+
+    std::cout << "Building the DSM pyramid" << std::endl;
+    std::atomic_store(&dsmPyramid, reader.buildPyramid());
+}
+
+// Building pixels of the DSM, set by buildBuildingMask()
+const BuildingMask* GetBuildingMask() {
+    return std::atomic_load(&buildingMask).get();
+}
+
+// Flags once the DSM pixels standing more than minHeight over the ground, the ground being resampled
+// on the DSM grid when both rasters differ. Pixels without data in either raster aren't buildings, as
+// in the per-sample test of GetRayLoS, so LoS samples only look up their pixel. Only done when both
+// rasters are memory-backed: rasters read on demand keep the per-sample test rather than being read
+// in full. Built once per initializeReaders(), by the first computation, so startup stays instant.
+void buildBuildingMask(double minHeight) {
+    static std::mutex buildMutex;
+    std::lock_guard<std::mutex> lock(buildMutex);
+    if (std::atomic_load(&buildingMask) || !reader.isMemoryBacked() || !groundReader.isMemoryBacked()) {
+        return;
+    }
+
+    std::cout << "Building the building mask" << std::endl;
+    int width = reader.getWidth();
+    std::vector<float> dsmRow(width), groundRow(width);
+    auto mask = std::make_shared<const BuildingMask>(width, reader.getHeight(), [&](int line, std::vector<uint8_t>& row) {
+        reader.readRows(line, 1, dsmRow.data());
+        groundReader.readResampled(reader, line, groundRow.data());
+        for (int pixel = 0; pixel < width; ++pixel) {
+            row[pixel] = !reader.isNoData(dsmRow[pixel]) && !groundReader.isNoData(groundRow[pixel]) &&
+                         dsmRow[pixel] - groundRow[pixel] > minHeight;
+        }
+    });
+    std::atomic_store(&buildingMask, mask);
+    reader.flushCacheStats();
+    groundReader.flushCacheStats();
 }
 
 // const char* groundTiffFile = "data/montreal/montreal_MNT.tif";
@@ -105,29 +204,6 @@ double CalculateDistance(double lat1, double lon1, double lat2, double lon2) {
     return distance;
 }
 
-double GetRayHeight(double antElevation, double antLat, double antLng, double UEElevation, double UELat, double UELng, double lastPeakLat, double lastPeakLng) { //update lastPeaks type
-    double opp = antElevation - UEElevation;
-    double adj = CalculateDistance(antLat, antLng, UELat, UELng);
-    double newAdj = CalculateDistance(lastPeakLat, lastPeakLng, UELat, UELng);
-
-    double newOpp = opp * newAdj / adj;
-
-    return UEElevation + newOpp;
-}
-
-double calculateNewAngle(double antElevation, double antLat, double antLng, double UEElevation, double UELat, double UELng) {
-    double opp = UEElevation - antElevation; // Vertical difference (opposite side)
-    double adj = CalculateDistance(antLat, antLng, UELat, UELng); // Horizontal distance (adjacent side)
-
-    double newAngle = atan2(opp, adj);
-
-    // Convert angle to degrees
-    newAngle = newAngle * (180.0 / M_PI);
-
-    return newAngle;
-}
-
-
 double GetElevation(double latitude, double longitude, double height) {
     //Call GDAL to get elevation at coord
     // std::string lat = std::to_string(latitude);
@@ -145,23 +221,36 @@ double GetElevation(double latitude, double longitude, double height) {
     // std::cout << "lat and lon used is : " << latitude << ", " << longitude << std::endl;
 
 
-    double elevation = reader.getElevation(latitude, longitude);
+    // Outside the raster or on a nodata pixel, there is no elevation (NaN) rather than a sentinel
+    // that would be classified like any other
+    ElevationReader& dsm = DsmReader();
+    float elevation = dsm.getElevation(latitude, longitude);
+    if (dsm.isNoData(elevation)) {
+        return NO_ELEVATION;
+    }
+    return elevation + height;
+}
 
-    if (elevation == -1) {
-        // TODO: check nodata value in code, because -1 should be possible in city "valleys" unless it is nodata.
+// Same as GetElevation for a sample already projected on the DSM grid
+double GetElevationAtPixel(int pixel, int line, double height) {
+    ElevationReader& dsm = DsmReader();
+    if (!dsm.containsPixel(pixel, line)) {
+        return NO_ELEVATION;
+    }
 
-        std::cout << "elevation is -1" << std::endl;
-        return -1000;
+    float elevation = dsm.getElevationAtPixel(pixel, line);
+    if (dsm.isNoData(elevation)) {
+        return NO_ELEVATION;
     }
     return elevation + height;
 }
 
+// Ground elevation, NaN outside the ground raster or on its nodata pixels
 double GetGroundElevation(double latitude, double longitude) {
-    double gndElevation = groundReader.getElevation(latitude, longitude);
-    if (gndElevation == -1) {
-        // TODO: check nodata value in code, because -1 should be possible in city "valleys" unless it is nodata.
-        std::cout << "elevation is -1" << std::endl;
-        return -1000;
+    ElevationReader& ground = GroundReader();
+    float gndElevation = ground.getElevation(latitude, longitude);
+    if (ground.isNoData(gndElevation)) {
+        return NO_ELEVATION;
     }
     return gndElevation;
 }
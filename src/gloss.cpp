@@ -6,86 +6,423 @@
 #include <mutex>
 #include <map>
 #include <fstream>
+#include <atomic>
+#include <future>
 #include <fmt/core.h>
 
 #include "utils/json.hpp"
 #include "../include/gloss.hpp"
-#include "gridpaths.cpp"
+#include "viewshed.cpp"
+#include "classes/result_file.cpp"
+#include "classes/los_tiff.cpp"
 
 std::string antennaFilename = "";
+std::vector<Antenna> antennaTable; // Antennas given by setAntennas(), used until another antenna file is set
+bool hasAntennaTable = false;
 std::string output_path = "los_datasets/";
 
+// Binary writes one .glos dataset per antenna (see classes/result_file.cpp), Json the legacy indented JSON,
+// Horizons a JSON summary with the class transitions of every ray (see toHorizons), GeoTiff the codes
+// rasterized on the DSM grid (see classes/los_tiff.cpp)
+enum class OutputFormat { Binary, Json, Horizons, GeoTiff };
+OutputFormat outputFormat = OutputFormat::Binary;
+
+// With coverage on, compute() folds every antenna into CoverageMaps over the whole DSM (see
+// classes/coverage.cpp) and, unless keepResultsWithCoverage, drops its LoSResult right away
+bool coverageEnabled = false;
+bool keepResultsWithCoverage = false;
+std::shared_ptr<CoverageMaps> coverageMaps;
+
 namespace gloss {
 
     void setAntennaFilename(std::string filename) {
+        auto lock = LockSettings();
         antennaFilename = filename;
+        if (!filename.empty()) {
+            antennaTable.clear();
+            hasAntennaTable = false;
+        }
+    }
+
+    // Antennas for the next computations, instead of reading the antenna file
+    void setAntennas(std::vector<Antenna> antennas) {
+        auto lock = LockSettings();
+        antennaTable = std::move(antennas);
+        hasAntennaTable = true;
     }
 
     void setOutputPath(std::string path) {
+        auto lock = LockSettings();
         output_path = path;
     }
 
-    // Function to be executed by each thread
-    void ThreadFunc(Antenna antenna, AntennaDict& antennaDict, std::mutex& dictMutex) {
-        Grid paths = GetPathLoS(antenna);
+    void setOutputFormat(OutputFormat format) {
+        auto lock = LockSettings();
+        outputFormat = format;
+    }
+
+    void setTraversalMode(TraversalMode mode) {
+        auto lock = LockSettings();
+        traversalMode = mode;
+    }
+
+    void setEngine(LoSEngine engine) {
+        auto lock = LockSettings();
+        losEngine = engine;
+    }
 
-        std::lock_guard<std::mutex> lock(dictMutex);
-        antennaDict[antenna.id] = paths;
+    // Bisects neighbouring rays disagreeing over more than distanceThreshold meters, down to
+    // minAngleStep degrees. A step of ANGLE_STEP or more turns the refinement off.
+    void setAngularRefinement(double minAngleStep, double distanceThreshold) {
+        if (!(minAngleStep > 0.0) || distanceThreshold < 0.0) {
+            throw std::runtime_error("Invalid angular refinement settings.");
+        }
+        auto lock = LockSettings();
+        MIN_ANGLE_STEP = minAngleStep;
+        REFINEMENT_DISTANCE = distanceThreshold;
     }
 
-    // Initialize all readers and settings
-    void initialize(const std::string& antennaFile, const std::string& tiffFile, const std::string& groundTiffFile) {
+    // Aggregate coverage maps for the next computations. Without keepResults, compute() returns an
+    // empty dict and only the maps remain.
+    void setCoverage(bool enabled, bool keepResults) {
+        auto lock = LockSettings();
+        coverageEnabled = enabled;
+        keepResultsWithCoverage = keepResults;
+    }
+
+    // Maps of the last computation run with coverage on, null before the first one
+    std::shared_ptr<CoverageMaps> getCoverage() {
+        return std::atomic_load(&coverageMaps);
+    }
+
+    // Byte budget of each raster's block cache (DSM and ground are budgeted separately)
+    void setTileCacheSize(size_t budgetBytes) {
+        auto lock = LockSettings();
+        setTileCacheBudget(budgetBytes);
+    }
+
+    // Instruction set of the lane kernel classifying pixel rays: "avx2", "sse2" or "scalar"
+    std::string getRayKernel() {
+        return GetLaneKernelName();
+    }
+
+    // Forces the lane kernel, "auto" for the widest one the CPU runs. Throws if the CPU can't run it.
+    void setRayKernel(const std::string& name) {
+        SetLaneKernel(name);
+    }
+
+    std::map<std::string, TileCacheStats> getCacheStats() {
+        return {{"dsm", reader.getCacheStats()}, {"ground", groundReader.getCacheStats()}};
+    }
+
+    void printCacheStats() {
+        for (const auto& [name, stats] : getCacheStats()) {
+            std::cout << fmt::format("{} tile cache: {} hits, {} misses, {} evictions, {:.1f}/{:.1f} MB in use",
+                                     name, stats.hits, stats.misses, stats.evictions,
+                                     stats.bytesInUse / 1048576.0, stats.budgetBytes / 1048576.0) << std::endl;
+        }
+    }
+
+    // Number of worker threads used by compute(), 0 for one per hardware thread.
+    // Throws while a computation is running.
+    void setNumThreads(int count) {
+        SetThreadPoolSize(count > 0 ? static_cast<size_t>(count) : DefaultThreadCount());
+    }
+
+    int getNumThreads() {
+        std::lock_guard<std::mutex> lock(threadPoolMutex);
+        return static_cast<int>(numThreads);
+    }
+
+    // Initialize all readers and settings. Like the setters, throws while a computation is running.
+    void initialize(const std::string& antennaFile, const std::string& tiffFile, const std::string& groundTiffFile, bool inMemory) {
         std::cout << "Initializing with:" << std::endl;
         std::cout << "  Antenna file: " << antennaFile << std::endl;
         std::cout << "  TIFF file: " << tiffFile << std::endl;
         std::cout << "  Ground TIFF file: " << groundTiffFile << std::endl;
+        std::cout << "  In memory: " << (inMemory ? "yes" : "no") << std::endl;
 
         setAntennaFilename(antennaFile);
+        auto lock = LockSettings();
         setTiffFile(tiffFile.c_str());
         setGroundTiffFile(groundTiffFile.c_str());
-        initializeReaders();
+        initializeReaders(inMemory);
     }
 
-    // Core computation function
-    AntennaDict compute() {
+    // Progress of a computation, shared with the handle returned by computeAsync()
+    struct ComputeState {
+        std::atomic<int> completed{0};
+        std::atomic<bool> cancelled{false};
+        int total = 0;
+    };
+
+    std::vector<Antenna> loadAntennas() {
+        if (hasAntennaTable) {
+            return antennaTable;
+        }
         if (antennaFilename.empty()) {
-            throw std::runtime_error("Antenna filename not set. Call initialize() first.");
+            throw std::runtime_error("Antenna filename not set. Call initialize() or setAntennas() first.");
         }
+        return getAntennas(antennaFilename);
+    }
 
-        std::vector<Antenna> antennas = getAntennas(antennaFilename);
+    AntennaDict computeAntennas(const std::vector<Antenna>& antennas, ComputeState& state) {
         int numAntennas = antennas.size();
 
-        AntennaDict antennaDict;
-        std::vector<std::thread> threads;
-        std::mutex dictMutex;
+        // Sectors sharing a mast are marched together, unless rays are refined per sector.
+        // Each antenna writes its own slot, so workers never synchronize on the results.
+        std::vector<std::vector<int>> sites = groupBySite(antennas);
+        std::vector<LoSResult> results(numAntennas);
+        ThreadPool& pool = GetThreadPool();
+        std::cout << "Computing " << numAntennas << " antennas (" << sites.size() << " sites) on " << pool.size() << " threads" << std::endl;
+
+        std::shared_ptr<CoverageMaps> coverage;
+        if (coverageEnabled) {
+            std::atomic_store(&coverageMaps, std::shared_ptr<CoverageMaps>()); // Frees the previous maps first, unless they are still referenced
+            ElevationReader& dsm = DsmReader();
+            coverage = std::make_shared<CoverageMaps>(dsm.getWidth(), dsm.getHeight(), dsm.getGeoTransform());
+        }
+
+        buildBuildingMask(BUILDING_MIN_HEIGHT);
+        if (losEngine == LoSEngine::Rays) {
+            PrepareRayTraversal();
+        }
 
-        for (int i = 0; i < numAntennas; ++i) {
-            threads.emplace_back(ThreadFunc, antennas[i], std::ref(antennaDict), std::ref(dictMutex));
-            // Temporarily removed true multithreading, which had race conditions causing seg fault crashes.
-            threads[i].join();
+        TaskGroup antennaTasks(pool);
+        for (const std::vector<int>& site : sites) {
+            antennaTasks.run([&antennas, &results, &state, &site, &coverage] {
+                if (state.cancelled) {
+                    return;
+                }
+                if (losEngine == LoSEngine::Viewshed) {
+                    for (int i : site) {
+                        results[i] = GetViewshedLoS(antennas[i]);
+                    }
+                } else if (site.size() == 1 || IsRefinementEnabled()) {
+                    for (int i : site) {
+                        results[i] = GetPathLoS(antennas[i]);
+                    }
+                } else {
+                    std::vector<Antenna> sectors;
+                    for (int i : site) {
+                        sectors.push_back(antennas[i]);
+                    }
+                    std::vector<LoSResult> sectorResults = GetSitePathLoS(sectors);
+                    for (size_t s = 0; s < site.size(); ++s) {
+                        results[site[s]] = std::move(sectorResults[s]);
+                    }
+                }
+                if (coverage) {
+                    for (int i : site) {
+                        std::vector<CoverageHit> hits = GetVisibleCells(results[i], *coverage);
+                        coverage->addAntenna(antennas[i].id, hits);
+                        if (!keepResultsWithCoverage) {
+                            results[i] = LoSResult();
+                        }
+                    }
+                }
+                state.completed += site.size();
+            });
         }
+        antennaTasks.wait();
+
+        if (state.cancelled) {
+            throw std::runtime_error("Computation cancelled");
+        }
+
+        AntennaDict antennaDict;
+        if (coverage) {
+            std::cout << fmt::format("Coverage maps: {:.1f} MB", coverage->getMemoryUsage() / 1048576.0) << std::endl;
+            std::atomic_store(&coverageMaps, coverage);
+        }
+        if (!coverage || keepResultsWithCoverage) {
+            for (int i = 0; i < numAntennas; ++i) {
+                antennaDict[antennas[i].id] = std::move(results[i]);
+            }
+        }
+
+        printCacheStats();
 
         return antennaDict;
     }
 
-    // Save results to JSON files
+    // Core computation function
+    AntennaDict compute() {
+        ThreadPoolUse poolUse;
+        std::vector<Antenna> antennas = loadAntennas();
+        ComputeState state;
+        state.total = antennas.size();
+        return computeAntennas(antennas, state);
+    }
+
+    ComputeHandle::ComputeHandle(std::shared_ptr<ComputeState> state, std::shared_future<AntennaDict> future)
+        : state(std::move(state))
+        , future(std::move(future)) {}
+
+    bool ComputeHandle::done() const {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    double ComputeHandle::progress() const {
+        return state->total > 0 ? static_cast<double>(state->completed) / state->total : 1.0;
+    }
+
+    void ComputeHandle::cancel() {
+        state->cancelled = true;
+    }
+
+    const AntennaDict& ComputeHandle::result() const {
+        return future.get();
+    }
+
+    // The antenna file is read before returning so a bad file is reported right away.
+    // The computation itself runs as a pool task, helping its antenna tasks while it waits.
+    ComputeHandle computeAsync() {
+        auto poolUse = std::make_shared<ThreadPoolUse>();
+        auto antennas = std::make_shared<std::vector<Antenna>>(loadAntennas());
+        auto state = std::make_shared<ComputeState>();
+        state->total = antennas->size();
+
+        auto promise = std::make_shared<std::promise<AntennaDict>>();
+        std::shared_future<AntennaDict> future = promise->get_future().share();
+        GetThreadPool().submit([antennas, state, promise, poolUse]() mutable {
+            // The pool is released before the result is published, so once done() is true
+            // the number of threads can be changed again
+            try {
+                AntennaDict result = computeAntennas(*antennas, *state);
+                poolUse.reset();
+                promise->set_value(std::move(result));
+            } catch (...) {
+                poolUse.reset();
+                promise->set_exception(std::current_exception());
+            }
+        });
+
+        return ComputeHandle(state, future);
+    }
+
+    // Raster results give one row per raster line, with the cells that have a class and
+    // the coordinates of their center in the CRS of the DSM
+    Grid toGrid(const LoSResult& result) {
+        if (result.isRaster()) {
+            Grid grid(result.getNumRows());
+            for (size_t row = 0; row < result.getNumRows(); ++row) {
+                const uint8_t* codes = result.getRowCodes(row);
+                for (size_t column = 0; column < result.getStride(); ++column) {
+                    if (codes[column] != static_cast<uint8_t>(LoSClass::NoSample)) {
+                        grid[row].push_back({result.getCellCenter(row, column), static_cast<Elevation>(codes[column])});
+                    }
+                }
+            }
+            return grid;
+        }
+
+        Grid grid(result.getNumRays());
+        for (size_t ray = 0; ray < result.getNumRays(); ++ray) {
+            std::vector<Coordinate> coordinates = result.getCoordinates(ray);
+            grid[ray].reserve(coordinates.size());
+            for (int i = 0; i < result.getNumSamples(ray); ++i) {
+                grid[ray].push_back({coordinates[i], static_cast<Elevation>(result.getClass(ray, i))});
+            }
+        }
+        return grid;
+    }
+
+    RayHorizons toHorizons(const LoSResult& result) {
+        if (result.isRaster()) {
+            throw std::runtime_error("Horizon summaries need ray results, not viewshed rasters.");
+        }
+        RayHorizons horizons(result.getNumRays());
+        for (size_t ray = 0; ray < result.getNumRays(); ++ray) {
+            horizons[ray] = GetRayHorizon(result, ray);
+        }
+        return horizons;
+    }
+
+    // One JSON object per ray: its bearing, length in meters and [distance, class] transitions
+    void writeHorizonFile(const std::string& filename, const LoSResult& result) {
+        RayHorizons horizons = toHorizons(result);
+        Coordinate origin = result.getOrigin();
+        json raysJson = json::array();
+        for (size_t ray = 0; ray < horizons.size(); ++ray) {
+            const RayGeometry& geometry = result.getRay(ray);
+            json transitions = json::array();
+            for (const auto& [distance, value] : horizons[ray]) {
+                transitions.push_back({distance, static_cast<int>(value)});
+            }
+            raysJson.push_back({{"bearing", geometry.bearing},
+                                {"length", CalculateDistance(origin.first, origin.second, geometry.end.first, geometry.end.second)},
+                                {"transitions", transitions}});
+        }
+
+        std::ofstream out(filename);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not open file " + filename + " for writing.");
+        }
+        out << json({{"origin", {origin.first, origin.second}}, {"rays", raysJson}}).dump();
+    }
+
+    // Viewshed results are already on the DSM grid, rays are rasterized first
+    void writeResultTiff(const std::string& filename, const LoSResult& result) {
+        std::string wkt = DsmReader().getWkt();
+        if (result.isRaster()) {
+            writeLoSTiff(filename, result.getRasterWindow(), result.getCodes().data(), wkt);
+            return;
+        }
+        std::vector<uint8_t> cells;
+        RasterWindow window = RasterizeRays(result, cells);
+        writeLoSTiff(filename, window, cells.data(), wkt);
+    }
+
+    // Save results to one file per antenna
     void saveResults(const AntennaDict& antennaDict) {
+        // Check if output_path directory exists, if not create it
+        struct stat info;
+        if (stat(output_path.c_str(), &info) != 0) {
+            std::cout << "Output directory does not exist. Creating directory: " << output_path << std::endl;
+            #ifdef _WIN32
+                _mkdir(output_path.c_str());
+            #else 
+                mkdir(output_path.c_str(), 0777);
+            #endif
+        }
+
         for (const auto& [key, value] : antennaDict) {
-            std::string filename = fmt::format("{}/los_dataset_{}.json", output_path, key);
-            
-            // Check if output_path directory exists, if not create it
-            struct stat info;
-            if (stat(output_path.c_str(), &info) != 0) {
-                std::cout << "Output directory does not exist. Creating directory: " << output_path << std::endl;
-                #ifdef _WIN32
-                    _mkdir(output_path.c_str());
-                #else 
-                    mkdir(output_path.c_str(), 0777);
-                #endif
+            if (outputFormat == OutputFormat::Binary) {
+                std::string filename = fmt::format("{}/los_dataset_{}{}", output_path, key, LOS_FILE_EXTENSION);
+                try {
+                    writeLoSFile(filename, key, value);
+                    std::cout << "Successfully wrote " << filename << std::endl;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+                continue;
             }
+            if (outputFormat == OutputFormat::GeoTiff) {
+                std::string filename = fmt::format("{}/los_dataset_{}.tif", output_path, key);
+                try {
+                    writeResultTiff(filename, value);
+                    std::cout << "Successfully wrote " << filename << std::endl;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+                continue;
+            }
+            if (outputFormat == OutputFormat::Horizons) {
+                std::string filename = fmt::format("{}/los_horizons_{}.json", output_path, key);
+                try {
+                    writeHorizonFile(filename, value);
+                    std::cout << "Successfully wrote " << filename << std::endl;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+                continue;
+            }
+
+            std::string filename = fmt::format("{}/los_dataset_{}.json", output_path, key);
 
             json valueJson = json::array();
-            for (const auto& vec : value) {
+            for (const auto& vec : toGrid(value)) {
                 valueJson.push_back(vec);
             }
 
@@ -99,19 +436,69 @@ namespace gloss {
             }
         }
     }
+
+    // Reads back binary datasets, from one .glos file or from every one of a directory
+    AntennaDict loadResults(const std::string& path) {
+        if (std::filesystem::is_directory(path)) {
+            return readLoSDirectory(path);
+        }
+        int antennaId = 0;
+        LoSResult result = readLoSFile(path, &antennaId);
+        AntennaDict antennaDict;
+        antennaDict[antennaId] = std::move(result);
+        return antennaDict;
+    }
 }
 
 // using namespace gloss;
 
 int main(int argc, char* argv[]) {
+    if (argc == 4 && std::string(argv[1]) == "--convert") {
+        try {
+            convertToGlossDem(argv[2], argv[3]);
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     if (argc < 4) {
-        std::cerr << "Usage: " << argv[0] << " <antenna_filename> <tiff_file> <ground_tiff_file>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <antenna_filename> <tiff_file> <ground_tiff_file> [--in-memory] [--pixel-traversal] [--viewshed] [--min-angle-step DEG] [--ray-kernel NAME] [--threads N] [--json] [--horizons] [--geotiff]" << std::endl;
+        std::cerr << "       " << argv[0] << " --convert <tiff_file> <glossdem_file>" << std::endl;
         return 1;
     }
 
     try {
+        bool inMemory = false;
+        for (int i = 4; i < argc; ++i) {
+            std::string option = argv[i];
+            if (option == "--in-memory") {
+                inMemory = true;
+            } else if (option == "--pixel-traversal") {
+                gloss::setTraversalMode(TraversalMode::Pixel);
+            } else if (option == "--viewshed") {
+                gloss::setEngine(LoSEngine::Viewshed);
+            } else if (option == "--min-angle-step" && i + 1 < argc) {
+                gloss::setAngularRefinement(std::stod(argv[++i]), REFINEMENT_DISTANCE);
+            } else if (option == "--json") {
+                gloss::setOutputFormat(OutputFormat::Json);
+            } else if (option == "--horizons") {
+                gloss::setOutputFormat(OutputFormat::Horizons);
+            } else if (option == "--geotiff") {
+                gloss::setOutputFormat(OutputFormat::GeoTiff);
+            } else if (option == "--ray-kernel" && i + 1 < argc) {
+                gloss::setRayKernel(argv[++i]);
+            } else if (option == "--threads" && i + 1 < argc) {
+                gloss::setNumThreads(std::stoi(argv[++i]));
+            } else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+
         // Initialize with command line arguments
-        gloss::initialize(argv[1], argv[2], argv[3]);
+        gloss::initialize(argv[1], argv[2], argv[3], inMemory);
 
         // Run computation
         AntennaDict results = gloss::compute();
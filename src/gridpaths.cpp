@@ -3,16 +3,18 @@
 #include <cmath>
 #include <utility>
 #include <random>
+#include <climits>
+#include <limits>
+#include <algorithm>
+#include <functional>
 
+#include "pixel_ray.hpp"
 #include "elevation.cpp"
 #include "azimuth_and_sec.cpp"
+#include "classes/thread_pool.cpp"
+#include "ray_kernel.cpp"
 
 
-float DEFAULT_LOS_ELEVATION = 100.0;
-float DEFAULT_LOS_IN_BUILDING = 50.0;
-float DEFAULT_LOS_OUTSIDE_REGION = 25.0; // Assumes that the points outside the upper and lower region bounds of the antenna are null.
-float DEFAULT_NLOS_ELEVATION = 0.0;
-
 double UE_HEIGHT = 1.5;
 double BUILDING_MIN_HEIGHT = 5.0;
 
@@ -22,8 +24,33 @@ const double RADIUS_STEP = 0.00001; // Granularity (step size), double check wit
                                         // number of steps are calculated
 const int ANGLE_STEP = 1; // TODO: change to double and adapt code
 const int MINIMAL_DISTANCE = 12; // All points under 12m are considered LoS
+const size_t RAYS_PER_TASK = 8; // Rays of an antenna computed by one pool task, one per lane of the lane kernel
+const double SHADOW_MARGIN = 0.01; // Meters kept between a skipped block and the shadow of the last peak
+
+// Adaptive angular refinement: neighbouring rays whose visibility disagrees over more than
+// REFINEMENT_DISTANCE meters are bisected, down to MIN_ANGLE_STEP. ANGLE_STEP disables it.
+double MIN_ANGLE_STEP = ANGLE_STEP;
+double REFINEMENT_DISTANCE = 50.0;
+
+// How rays are sampled: LatLon steps RADIUS_STEP degrees and projects every sample,
+// Pixel projects the ray once and visits each crossed DSM pixel exactly once.
+enum class TraversalMode { LatLon, Pixel };
+TraversalMode traversalMode = TraversalMode::LatLon;
+
+const int NO_PIXEL = INT_MIN;
+
+struct RaySample {
+    Coordinate coord;
+    int pixel = NO_PIXEL; // DSM pixel/line when the sample comes from a pixel traversal
+    int line = NO_PIXEL;
+    double distance = 0.0; // Meters from the antenna, along the ray
+    double t = 0.0; // Position along the ray, 0 at the antenna and 1 at its end
+};
 
 using namespace std;
+using gloss::LoSClass;
+using gloss::LoSResult;
+using gloss::RayGeometry;
 
 Coordinate GetAntennaCoordinates(Antenna antenna) {
     //Add logic to get coordinate
@@ -52,61 +79,869 @@ Coordinate CalculateDestination(double lat, double lng, double bearing, double d
     return {destLat, destLng};                                 
 }
 
-vector<Coordinate> GeneratePath(double startLat, double startLng, double endLat, double endLng) {
-    // Once sure if the calculations are correct in CalculateDestination...
-    // TODO: (?) change path subdivision to, instead of dividing by radius (degree) step, divides
-    // by the same number of steps in all directions (or not necessary?)
-
-    vector<Coordinate> path;
-    
+// Number of RADIUS_STEP steps between two coordinates, the path has one more sample
+int GetPathSteps(double startLat, double startLng, double endLat, double endLng) {
     double deltaLat = endLat - startLat;
     double deltaLng = endLng - startLng;
     double distance = sqrt(deltaLat * deltaLat + deltaLng * deltaLng);
-    int numSteps = static_cast<int>(distance / RADIUS_STEP);
 
     // TODO: recheck calculation, I believe they're incorrect because
     // 1 lat VS 1 long degree don't represent the same "ground" distance here. 
 
     // possible improvement to be tested:    
-    // int numSteps = static_cast<int>(MAX_HORIZON_DISTANCE / RADIUS_STEP);
+    // return static_cast<int>(MAX_HORIZON_DISTANCE / RADIUS_STEP);
+    return static_cast<int>(distance / RADIUS_STEP);
+}
+
+// Samples of one ray generated one at a time, in order: lat/lon rays step RADIUS_STEP degrees from
+// the antenna, pixel rays visit each DSM pixel they cross once. Only the current position is kept,
+// so a ray never holds more than one sample whatever its length. Coordinates and distances are
+// interpolated along the ray; lat/lon samples are projected once to find their DSM pixel.
+// The ray is clipped to the DSM up front: its footprint is the part of the segment between its
+// projected ends that lies over the raster, so the samples past it are known without reading them.
+class RaySampler {
+public:
+    RaySampler(Coordinate start, const RayGeometry& ray)
+        : start(start)
+        , end(ray.end)
+        , pixelSpace(ray.pixelSpace)
+        , traversal(ray.startPx, ray.startPy, ray.endPx, ray.endPy)
+        , length(CalculateDistance(start.first, start.second, ray.end.first, ray.end.second))
+        , dsm(&DsmReader()) {
+        if (!pixelSpace) {
+            // TODO: should start at i = 1 to exclude antenna? probably better, but would need
+            // to add antenna to the first pathLos manually as a LOS just in case a UE is under antenna (theoretically)
+            numSteps = GetPathSteps(start.first, start.second, end.first, end.second);
+            step = length / numSteps;
+        }
+        clipToRaster(ray);
+    }
+
+    bool isPixelSpace() const {
+        return pixelSpace;
+    }
+
+    bool next(RaySample& sample) {
+        double t;
+        if (pixelSpace) {
+            if (!traversal.next(sample.pixel, sample.line, t)) {
+                return false;
+            }
+            sample.distance = t * length;
+        } else {
+            if (index > numSteps) {
+                return false;
+            }
+            // TODO: fix this logic to not "grow" lng linearly, because it is not the same value depending on lattitude
+            // OR switch to cartesian coordinates (ex. CRS like original data), would need to change read_tiff.cpp
+            t = static_cast<double>(index) / numSteps;
+            sample.distance = index * step;
+        }
+        sample.t = t;
+        sample.coord = {start.first + t * (end.first - start.first), start.second + t * (end.second - start.second)};
+        if (!pixelSpace && !dsm->toPixel(sample.coord.first, sample.coord.second, sample.pixel, sample.line)) {
+            sample.pixel = sample.line = NO_PIXEL;
+        }
+        index++;
+        return true;
+    }
+
+    // Moves past count samples
+    void skip(int count) {
+        RaySample sample;
+        for (int i = 0; i < count && next(sample); ++i) {
+        }
+    }
+
+    // Index after the run of samples, starting with the last one read, whose pixels share its block of
+    // 2^shift pixels inside the raster. The last sample of the run is returned in last; the sampler
+    // itself doesn't move.
+    int findBlockEnd(const RaySample& current, int shift, RaySample& last) const {
+        RaySampler ahead = *this;
+        int runEnd = index;
+        last = current;
+        RaySample sample;
+        while (ahead.next(sample) && (sample.pixel >> shift) == (current.pixel >> shift) && (sample.line >> shift) == (current.line >> shift) &&
+               dsm->containsPixel(sample.pixel, sample.line)) {
+            last = sample;
+            runEnd++;
+        }
+        return runEnd;
+    }
+
+    // Whether a sample is past the footprint, and so is every sample after it
+    bool isPastRaster(const RaySample& sample) const {
+        return sample.t > footprintEnd;
+    }
+
+    // Whether a sample not past the footprint has a DSM pixel. Samples before the footprint don't,
+    // nor the few inside it that land just off the raster edge.
+    bool isOnRaster(const RaySample& sample) const {
+        return sample.t >= footprintStart && dsm->containsPixel(sample.pixel, sample.line);
+    }
+
+    // Index of the first sample past the footprint, numSamples when the ray ends over the raster,
+    // and at least the index of the next sample. The sampler itself doesn't move.
+    int findFootprintEnd(int numSamples) const {
+        if (footprintEnd >= 1.0) {
+            return numSamples;
+        }
+        if (!pixelSpace) {
+            double lastInside = floor(footprintEnd * numSteps);
+            return max(index, static_cast<int>(min(static_cast<double>(numSamples), lastInside + 1.0)));
+        }
+        gloss::PixelRay ahead = traversal;
+        int footprintIndex = index;
+        int pixel, line;
+        double t;
+        while (ahead.next(pixel, line, t) && t <= footprintEnd) {
+            footprintIndex++;
+        }
+        return footprintIndex;
+    }
+
+private:
+    // Liang-Barsky clipping of the segment between the pixel positions of the ray ends to the
+    // raster. Rays whose ends can't be projected aren't clipped, their samples are checked one by one.
+    void clipToRaster(const RayGeometry& ray) {
+        double x0 = ray.startPx, y0 = ray.startPy, x1 = ray.endPx, y1 = ray.endPy;
+        if (!pixelSpace && (!dsm->toPixelSpace(start.first, start.second, x0, y0) || !dsm->toPixelSpace(end.first, end.second, x1, y1))) {
+            return;
+        }
+
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        const double offsets[4] = {x0, dsm->getWidth() - x0, y0, dsm->getHeight() - y0};
+        const double directions[4] = {-dx, dx, -dy, dy};
+        for (int edge = 0; edge < 4; ++edge) {
+            if (directions[edge] == 0.0) {
+                if (offsets[edge] < 0.0) {
+                    footprintEnd = -1.0; // Parallel to the edge, outside of it
+                    return;
+                }
+                continue;
+            }
+            double crossing = offsets[edge] / directions[edge];
+            if (directions[edge] < 0.0) {
+                footprintStart = max(footprintStart, crossing);
+            } else {
+                footprintEnd = min(footprintEnd, crossing);
+            }
+        }
+        if (footprintStart > footprintEnd) {
+            footprintEnd = -1.0;
+        }
+    }
+
+    Coordinate start;
+    Coordinate end;
+    bool pixelSpace;
+    gloss::PixelRay traversal;
+    double length;
+    int numSteps = 0;
+    double step = 0.0;
+    int index = 0; // Index of the next sample
+    ElevationReader* dsm; // Thread reader projecting lat/lon samples
+    double footprintStart = 0.0; // Part of the ray over the raster, in ray positions
+    double footprintEnd = 1.0;
+};
 
-    // TODO: should start at i = 1 to exclude antenna? probably better, but would need
-    // to add antenna to the first pathLos manually as a LOS just in case a UE is under antenna (theoretically)
-    for (int i = 0; i <= numSteps; ++i) {
-        // TODO: fix this logic to not "grow" lng linearly, because it is not the same value depending on lattitude
-        // OR switch to cartesian coordinates (ex. CRS like original data), would need to change read_tiff.cpp
-        double t = static_cast<double>(i) / numSteps;
-        double lat = startLat + t * deltaLat;
-        double lng = startLng + t * deltaLng;
-        path.emplace_back(lat, lng);
+int CountPixelSamples(double startPx, double startPy, double endPx, double endPy) {
+    gloss::PixelRay ray(startPx, startPy, endPx, endPy);
+    int pixel, line, count = 0;
+    double t;
+    while (ray.next(pixel, line, t)) {
+        count++;
     }
+    return count;
+}
+
+// Geometry of one ray. Pixel rays start at the antenna pixel position antPx, antPy.
+RayGeometry MakeRay(Coordinate antCoord, double bearing, bool pixelSpace, double antPx, double antPy) {
+    Coordinate endCoord = CalculateDestination(antCoord.first, antCoord.second, bearing, MAX_HORIZON_DISTANCE);
+
+    RayGeometry ray;
+    ray.bearing = bearing;
+    ray.end = endCoord;
+    if (pixelSpace && DsmReader().toPixelSpace(endCoord.first, endCoord.second, ray.endPx, ray.endPy)) {
+        ray.pixelSpace = true;
+        ray.startPx = antPx;
+        ray.startPy = antPy;
+        ray.numSamples = CountPixelSamples(antPx, antPy, ray.endPx, ray.endPy);
+    } else {
+        ray.numSamples = GetPathSteps(antCoord.first, antCoord.second, endCoord.first, endCoord.second) + 1;
+    }
+    return ray;
+}
+
+// Run-length summary of one ray of a result: the distance from the antenna (meters along the ray)
+// of every sample whose class differs from the previous one, with that class, starting with the
+// first sample. Distances are rebuilt from the geometry as RaySampler generates them, so nothing
+// is read or projected and only the codes of the ray are scanned.
+vector<pair<double, LoSClass>> GetRayHorizon(const LoSResult& result, size_t ray) {
+    const RayGeometry& geometry = result.getRay(ray);
+    const uint8_t* codes = result.getRayCodes(ray);
+    Coordinate origin = result.getOrigin();
+    double length = CalculateDistance(origin.first, origin.second, geometry.end.first, geometry.end.second);
+
+    vector<pair<double, LoSClass>> transitions;
+    auto addSample = [&](int index, double distance) {
+        if (index == 0 || codes[index] != codes[index - 1]) {
+            transitions.push_back({distance, static_cast<LoSClass>(codes[index])});
+        }
+    };
 
-    return path;
+    if (!geometry.pixelSpace) {
+        double step = geometry.numSamples > 1 ? length / (geometry.numSamples - 1) : 0.0;
+        for (int i = 0; i < geometry.numSamples; ++i) {
+            addSample(i, i * step);
+        }
+        return transitions;
+    }
+
+    gloss::PixelRay traversal(geometry.startPx, geometry.startPy, geometry.endPx, geometry.endPy);
+    int pixel, line;
+    double t;
+    for (int i = 0; i < geometry.numSamples && traversal.next(pixel, line, t); ++i) {
+        addSample(i, t * length);
+    }
+    return transitions;
+}
+
+// Order in which the classes of the samples falling in one DSM pixel win when they are rasterized:
+// the most visible one, so a pixel is LoS as soon as one ray sees it
+int GetVisibilityRank(uint8_t code) {
+    switch (static_cast<LoSClass>(code)) {
+        case LoSClass::LoS: return 5;
+        case LoSClass::LoSInBuilding: return 4;
+        case LoSClass::NLoS: return 3;
+        case LoSClass::OutsideRegion: return 2;
+        case LoSClass::NoData: return 1;
+        default: return 0;
+    }
 }
 
-vector<vector<Coordinate>> GetGridPaths(Antenna antenna) {
+// Rasterizes the rays of a result on the DSM grid: cells receives the codes of the window of DSM
+// pixels holding every ray (row-major, NoSample where no sample falls), each pixel taking the most
+// visible class of its samples. Samples are generated again by RaySampler, so they land on the
+// pixels they were classified on; those outside the DSM are dropped.
+gloss::RasterWindow RasterizeRays(const LoSResult& result, vector<uint8_t>& cells) {
+    ElevationReader& dsm = DsmReader();
+    Coordinate origin = result.getOrigin();
+
+    // Window around the pixel positions of the ray ends, rays being straight on the DSM grid
+    double minPx = numeric_limits<double>::infinity(), maxPx = -minPx;
+    double minPy = minPx, maxPy = -minPx;
+    auto include = [&](double lat, double lon) {
+        double px, py;
+        if (dsm.toPixelSpace(lat, lon, px, py)) {
+            minPx = min(minPx, px);
+            maxPx = max(maxPx, px);
+            minPy = min(minPy, py);
+            maxPy = max(maxPy, py);
+        }
+    };
+    include(origin.first, origin.second);
+    for (size_t ray = 0; ray < result.getNumRays(); ++ray) {
+        include(result.getRay(ray).end.first, result.getRay(ray).end.second);
+    }
+
+    gloss::RasterWindow window;
+    copy(dsm.getGeoTransform(), dsm.getGeoTransform() + 6, window.geoTransform);
+    if (minPx > maxPx || minPy > maxPy) {
+        cells.clear();
+        return window;
+    }
+    window.xOff = max(0, static_cast<int>(floor(minPx)) - 1);
+    window.yOff = max(0, static_cast<int>(floor(minPy)) - 1);
+    window.width = max(0, min(dsm.getWidth(), static_cast<int>(ceil(maxPx)) + 1) - window.xOff);
+    window.height = max(0, min(dsm.getHeight(), static_cast<int>(ceil(maxPy)) + 1) - window.yOff);
+    cells.assign(static_cast<size_t>(window.width) * window.height, static_cast<uint8_t>(LoSClass::NoSample));
+
+    for (size_t ray = 0; ray < result.getNumRays(); ++ray) {
+        const uint8_t* codes = result.getRayCodes(ray);
+        RaySampler sampler(origin, result.getRay(ray));
+        RaySample sample;
+        for (int i = 0; i < result.getNumSamples(ray) && sampler.next(sample); ++i) {
+            if (sample.pixel == NO_PIXEL) {
+                continue;
+            }
+            int column = sample.pixel - window.xOff;
+            int row = sample.line - window.yOff;
+            if (column < 0 || column >= window.width || row < 0 || row >= window.height) {
+                continue;
+            }
+            uint8_t& cell = cells[static_cast<size_t>(row) * window.width + column];
+            if (GetVisibilityRank(codes[i]) > GetVisibilityRank(cell)) {
+                cell = codes[i];
+            }
+        }
+    }
+    return window;
+}
+
+// Casts the rays around the antenna. Only their geometry is computed here, samples are
+// generated by the task classifying each ray. The gaps between rays far from the antenna
+// are filled by RefineRays where it matters.
+vector<RayGeometry> GetGridPaths(Antenna antenna) {
     Coordinate antCoord = GetAntennaCoordinates(antenna);
     int totalAngle = 360;
     int angleIncrease = ANGLE_STEP;
     int numPaths = totalAngle / angleIncrease;
     
-    vector<vector<Coordinate>> paths;
+    vector<RayGeometry> paths;
+
+    double antPx = 0.0, antPy = 0.0;
+    bool pixelSpace = traversalMode == TraversalMode::Pixel;
+    if (pixelSpace && !DsmReader().toPixelSpace(antCoord.first, antCoord.second, antPx, antPy)) {
+        cout << "Failed to project antenna " << antenna.id << ", falling back to lat/lon traversal." << endl;
+        pixelSpace = false;
+    }
 
-    // cout << "[";
-    // TODO: implement "progressive" raytracing, to fill the gaps between rays at far distances from the antenna.
     for (int i=0; i<numPaths; ++i) {
-        double angle = i * angleIncrease;
-        Coordinate endCoord = CalculateDestination(antCoord.first, antCoord.second, angle, MAX_HORIZON_DISTANCE);
-        // cout << "(" << antCoord.first << ", " << antCoord.second << "),";
-        vector<Coordinate> path = GeneratePath(antCoord.first, antCoord.second, endCoord.first, endCoord.second);
-        paths.push_back(path);
+        paths.push_back(MakeRay(antCoord, i * angleIncrease, pixelSpace, antPx, antPy));
     }
-    // cout << "]" << endl;
 
     return paths;
 }
 
-Grid GetPathLoS(Antenna antenna) {
+double GetSampleElevation(const RaySample& sample, double height) {
+    if (sample.pixel == NO_PIXEL) {
+        return GetElevation(sample.coord.first, sample.coord.second, height);
+    }
+    return GetElevationAtPixel(sample.pixel, sample.line, height);
+}
+
+// Whether a LoS sample with the given UE elevation stands on a building: one lookup in the building
+// mask for samples on the DSM, the ground raster is only read for samples outside it
+bool IsInBuilding(const RaySample& sample, double UEElevation) {
+    const BuildingMask* mask = GetBuildingMask();
+    if (mask != nullptr && DsmReader().containsPixel(sample.pixel, sample.line)) {
+        return mask->isBuilding(sample.pixel, sample.line);
+    }
+    // Compare with ground elevation to check if on a building,
+    double structureHeight = UEElevation - UE_HEIGHT - GetGroundElevation(sample.coord.first, sample.coord.second);
+    return structureHeight > BUILDING_MIN_HEIGHT;
+}
+
+// Reads the leading samples within MINIMAL_DISTANCE of the antenna and returns their count, the
+// last one read being the first peak. Lat/lon rays keep the historical one-sample-per-meter
+// approximation; pixel rays measure it.
+int ReadMinimalDistanceSamples(RaySampler& sampler, int numSamples, RaySample& last) {
+    sampler.next(last);
+    if (!sampler.isPixelSpace()) {
+        for (int count = 1; count < MINIMAL_DISTANCE && sampler.next(last); ++count) {
+        }
+        return MINIMAL_DISTANCE;
+    }
+
+    double firstDistance = last.distance;
+    int count = 1;
+    RaySampler ahead = sampler;
+    RaySample sample;
+    while (count < numSamples - 1 && ahead.next(sample) && sample.distance - firstDistance < MINIMAL_DISTANCE) {
+        sampler = ahead;
+        last = sample;
+        count++;
+    }
+    return count;
+}
+
+// DSM height under which a sample at distance meters is hidden by the last peak (the NLoS test of
+// GetRayLoS solved for the sample elevation)
+double GetShadowHeight(double antElevation, double peakSlope, double distance) {
+    return antElevation + peakSlope * distance - UE_HEIGHT;
+}
+
+// Run of samples crossing one pyramid block: index after its last sample, and that sample
+struct BlockRun {
+    int end = 0;
+    RaySample last;
+};
+
+// Number of samples from index on whose class follows from the pyramids without reading them,
+// tried on the largest block first. The block must stay at or under the antenna height so no
+// sample can trigger the downtilt limit, then the run of samples crossing it is
+// - NLoS when its highest pixel stays under the shadow of the last peak at both ends of the run;
+// - LoS when the first sample clears the last peak and the block relief is under UE_HEIGHT, so
+//   every sample sees over the previous one, and the building mask has no pixel in the block.
+// Runs are found by walking the ray ahead, only for the levels tried, and kept in runs (one per
+// level) while the ray stays in their block. The last sample of the run is returned in last.
+int GetBlockRun(const RaySample& sample, int index, const RaySampler& sampler, vector<BlockRun>& runs,
+                const ElevationPyramid& dsmPyramid, const BuildingMask* mask,
+                double antElevation, double peakSlope, LoSClass& runClass, RaySample& last) {
+    for (int level = dsmPyramid.getNumLevels() - 1; level >= 0; --level) {
+        double blockMax = dsmPyramid.getMax(level, sample.pixel, sample.line);
+        if (blockMax + UE_HEIGHT > antElevation) {
+            continue;
+        }
+
+        BlockRun& run = runs[level];
+        if (run.end <= index) {
+            run.end = sampler.findBlockEnd(sample, dsmPyramid.getBlockShift(level), run.last);
+        }
+        double firstShadow = GetShadowHeight(antElevation, peakSlope, sample.distance);
+        double lastShadow = GetShadowHeight(antElevation, peakSlope, run.last.distance);
+        if (blockMax <= min(firstShadow, lastShadow) - SHADOW_MARGIN) {
+            runClass = LoSClass::NLoS;
+            last = run.last;
+            return run.end - index;
+        }
+
+        double blockMin = dsmPyramid.getMin(level, sample.pixel, sample.line);
+        if (mask != nullptr && blockMin > firstShadow + SHADOW_MARGIN && blockMin > blockMax - UE_HEIGHT + SHADOW_MARGIN &&
+            !mask->blockHasBuildings(level, sample.pixel, sample.line)) {
+            runClass = LoSClass::LoS;
+            last = run.last;
+            return run.end - index;
+        }
+    }
+    return 0;
+}
+
+// Sample where the UE rises above the antenna with a steeper slope than every sample before it.
+// The downtilt limit of a sector is reached at the first one steeper than its downtilt.
+struct DowntiltCandidate {
+    int index;
+    double slope;
+};
+
+// Ray marched for a whole mast: the samples that could reach a downtilt limit, and the index of the
+// first sample past the footprint of the ray on the DSM, where a sector's NLoS fill stops
+struct SiteMarch {
+    vector<DowntiltCandidate> candidates;
+    int footprintEnd = 0;
+};
+
+// Slope (rise over distance) a UE must exceed to reach the downtilt limit: the tangent of the
+// downtilt, or 0 when dt <= 0 so that any UE over the antenna reaches it
+double GetDowntiltSlope(double downtilt) {
+    if (downtilt <= 0.0) {
+        return 0.0;
+    }
+    if (downtilt >= 90.0) {
+        return numeric_limits<double>::infinity();
+    }
+    return tan(downtilt * M_PI / 180.0);
+}
+
+// Sector test of a ray. Sectors wrapping around north keep their historical (empty) behaviour.
+bool IsInSector(double bearing, double lowerBound, double upperBound) {
+    return !(bearing > upperBound || bearing < lowerBound);
+}
+
+// Classifies the samples of one ray into its row of codes and returns the number of leading samples
+// considered LoS. Rays are independent, so they can run on any thread. With march set, the
+// downtilt limit isn't applied: the samples that could reach it and the footprint end are recorded
+// instead, so sectors sharing the mast can apply their own downtilt to the same march (see ApplySectorToRay).
+// Samples are on a straight line from the antenna, so the sight line tests are done on slopes
+// (rise over the distance from the antenna) with the distances of the path: a sample is hidden
+// when the last peak is at least as steep as the UE, and the downtilt is reached when the UE is
+// steeper than the downtilt slope. Samples without data, past the footprint of the ray on the DSM
+// or on nodata pixels, are NoData and take no part in these tests.
+int GetRayLoS(const Antenna& antenna, const RayGeometry& ray, double antElevation, bool inSector, uint8_t* codes,
+              SiteMarch* march = nullptr) {
+    RaySampler sampler(GetAntennaCoordinates(antenna), ray);
+    int numSamples = ray.numSamples;
+    if (march) {
+        march->footprintEnd = numSamples;
+    }
+    RaySample firstPeak;
+    int minimalSamples = ReadMinimalDistanceSamples(sampler, numSamples, firstPeak);
+
+    int leading = min(minimalSamples, numSamples);
+    fill(codes, codes + leading, static_cast<uint8_t>(LoSClass::LoS)); // for the first 12m everything is considered LoS
+    if (!inSector) { // If outside working regions for directional antenna
+        fill(codes + leading, codes + numSamples, static_cast<uint8_t>(LoSClass::OutsideRegion));
+        return minimalSamples;
+    }
+    if (leading == numSamples) {
+        return minimalSamples;
+    }
+
+    double peakSlope = (GetSampleElevation(firstPeak, UE_HEIGHT) - antElevation) * (1.0 / firstPeak.distance);
+    if (std::isnan(peakSlope)) { // No data under the first peak, the next sample with data is seen
+        peakSlope = -numeric_limits<double>::infinity();
+    }
+    double downtiltSlope = GetDowntiltSlope(antenna.dt);
+    if (march) { // Found as the single-antenna march finds it once the limit is reached
+        march->footprintEnd = sampler.findFootprintEnd(numSamples);
+    }
+
+    // Pixel rays can classify whole blocks of the DSM pyramid, tried each time the ray enters a new 8x8 block.
+    const ElevationPyramid* pyramid = ray.pixelSpace ? GetDsmPyramid() : nullptr;
+    vector<BlockRun> blockRuns;
+    int blockShift = 0;
+    if (pyramid) {
+        blockRuns.resize(pyramid->getNumLevels());
+        blockShift = pyramid->getBlockShift(0);
+    }
+
+    RaySample previous = firstPeak;
+    RaySample sample;
+    for (int index = minimalSamples; sampler.next(sample); ++index) {
+        if (sampler.isPastRaster(sample)) { // The rest of the ray is past the DSM
+            fill(codes + index, codes + numSamples, static_cast<uint8_t>(LoSClass::NoData));
+            break;
+        }
+        if (!sampler.isOnRaster(sample)) {
+            codes[index] = static_cast<uint8_t>(LoSClass::NoData);
+            continue;
+        }
+
+        bool newBlock = index == minimalSamples || (previous.pixel >> blockShift) != (sample.pixel >> blockShift) ||
+                        (previous.line >> blockShift) != (sample.line >> blockShift);
+        previous = sample;
+
+        if (pyramid && newBlock) {
+            LoSClass runClass;
+            int run = GetBlockRun(sample, index, sampler, blockRuns, *pyramid, GetBuildingMask(), antElevation, peakSlope, runClass, previous);
+            if (run > 0) {
+                fill(codes + index, codes + index + run, static_cast<uint8_t>(runClass));
+                sampler.skip(run - 1);
+                index += run - 1;
+                if (runClass == LoSClass::LoS) { // The last sample of the run becomes the peak
+                    peakSlope = (GetSampleElevation(previous, UE_HEIGHT) - UE_HEIGHT - antElevation) * (1.0 / previous.distance);
+                }
+                continue;
+            }
+        }
+
+        double UEElevation = GetSampleElevation(sample, UE_HEIGHT);
+        if (std::isnan(UEElevation)) { // Nodata pixel
+            codes[index] = static_cast<uint8_t>(LoSClass::NoData);
+            continue;
+        }
+        double inverseDistance = 1.0 / sample.distance;
+        double ueSlope = (UEElevation - antElevation) * inverseDistance;
+
+        bool reachedLOSLimit = false;
+        if (march) {
+            vector<DowntiltCandidate>& candidates = march->candidates;
+            if (ueSlope > 0.0 && (candidates.empty() || ueSlope > candidates.back().slope)) {
+                candidates.push_back({index, ueSlope});
+            }
+        } else {
+            reachedLOSLimit = ueSlope > downtiltSlope;
+        }
+
+        if (peakSlope >= ueSlope) {
+            codes[index] = static_cast<uint8_t>(LoSClass::NLoS);
+        } else {
+            if (IsInBuilding(sample, UEElevation)) {
+                codes[index] = static_cast<uint8_t>(LoSClass::LoSInBuilding);
+            }
+            else {
+                codes[index] = static_cast<uint8_t>(LoSClass::LoS);
+            }
+
+            peakSlope = (UEElevation - UE_HEIGHT - antElevation) * inverseDistance;
+        }
+
+        if (reachedLOSLimit) { // This sample is still classified, every following one over the DSM is NLoS
+            int footprintEnd = sampler.findFootprintEnd(numSamples);
+            fill(codes + index + 1, codes + footprintEnd, static_cast<uint8_t>(LoSClass::NLoS));
+            fill(codes + footprintEnd, codes + numSamples, static_cast<uint8_t>(LoSClass::NoData));
+            break;
+        }
+    }
+    return minimalSamples;
+}
+
+// Derives the codes of one sector from a ray marched for its whole mast: samples after the one
+// reaching the sector's downtilt limit become NLoS up to the footprint end recorded by the march,
+// as in a single-antenna march, rays outside the sector OutsideRegion.
+void ApplySectorToRay(const uint8_t* siteCodes, int numSamples, int minimalSamples, const SiteMarch& march,
+                      bool inSector, double downtilt, uint8_t* codes) {
+    if (!inSector) {
+        int leading = min(minimalSamples, numSamples);
+        fill(codes, codes + leading, static_cast<uint8_t>(LoSClass::LoS));
+        fill(codes + leading, codes + numSamples, static_cast<uint8_t>(LoSClass::OutsideRegion));
+        return;
+    }
+
+    int limit = numSamples;
+    double downtiltSlope = GetDowntiltSlope(downtilt);
+    for (const DowntiltCandidate& candidate : march.candidates) {
+        if (candidate.slope > downtiltSlope) {
+            limit = candidate.index + 1;
+            break;
+        }
+    }
+    int footprintEnd = max(limit, min(march.footprintEnd, numSamples));
+    copy(siteCodes, siteCodes + limit, codes);
+    fill(codes + limit, codes + footprintEnd, static_cast<uint8_t>(LoSClass::NLoS));
+    fill(codes + footprintEnd, codes + numSamples, static_cast<uint8_t>(LoSClass::NoData));
+}
+
+// One ray of a task classified by GetLanesLoS, with where its codes go
+struct LaneRay {
+    const RayGeometry* geometry;
+    bool inSector;
+    uint8_t* codes;
+    SiteMarch* march = nullptr; // Set when marching for a whole mast
+    int minimalSamples = 0;
+};
+
+// True when pixel rays can be classified by the lane kernel: elevations are then gathered
+// from the in-memory DSM, so its row-major indices must fit in 32 bits
+bool CanUseLaneKernel() {
+    const ElevationReader& dsm = DsmReader();
+    return traversalMode == TraversalMode::Pixel && dsm.getMemoryRaster() != nullptr &&
+           static_cast<int64_t>(dsm.getWidth()) * dsm.getHeight() <= INT32_MAX;
+}
+
+// Same classification as GetRayLoS for up to RAY_LANES rays, the in-sector pixel rays being
+// classified together by the lane kernel. Block runs of the DSM pyramid aren't used: with the
+// raster in memory, reading every sample in lockstep is cheaper than walking the blocks ray by ray.
+void GetLanesLoS(const Antenna& antenna, double antElevation, LaneRay* rays, int count) {
+    thread_local RayLanes lanes;
+    thread_local vector<uint8_t> visible, candidates;
+
+    ElevationReader& dsm = DsmReader();
+    const float* raster = dsm.getMemoryRaster();
+    float noData = dsm.getNoDataValue();
+    int width = dsm.getWidth();
+    Coordinate antCoord = GetAntennaCoordinates(antenna);
+
+    int lanesUsed = 0;
+    int laneRays[RAY_LANES];
+    int maxSamples = 0;
+    for (int r = 0; r < count; ++r) {
+        const RayGeometry& ray = *rays[r].geometry;
+        if (ray.pixelSpace && rays[r].inSector && ray.numSamples > 1 && lanesUsed < RAY_LANES) {
+            laneRays[lanesUsed++] = r;
+            maxSamples = max(maxSamples, ray.numSamples);
+        } else {
+            rays[r].minimalSamples = GetRayLoS(antenna, ray, antElevation, rays[r].inSector, rays[r].codes, rays[r].march);
+        }
+    }
+    if (lanesUsed == 0) {
+        return;
+    }
+
+    lanes.cells.assign(static_cast<size_t>(maxSamples) * RAY_LANES, -1);
+    lanes.fractions.assign(static_cast<size_t>(maxSamples) * RAY_LANES, 1.0);
+    lanes.first = maxSamples;
+    lanes.numSamples = 0;
+    for (int lane = 0; lane < RAY_LANES; ++lane) {
+        lanes.start[lane] = lanes.end[lane] = 0;
+        lanes.length[lane] = 1.0;
+        lanes.peakSlope[lane] = 0.0;
+    }
+
+    // Pixels of each ray, walked as RaySampler does
+    for (int lane = 0; lane < lanesUsed; ++lane) {
+        LaneRay& laneRay = rays[laneRays[lane]];
+        const RayGeometry& ray = *laneRay.geometry;
+        gloss::PixelRay traversal(ray.startPx, ray.startPy, ray.endPx, ray.endPy);
+        double length = CalculateDistance(antCoord.first, antCoord.second, ray.end.first, ray.end.second);
+
+        // The lane ends with the footprint of the ray, at the first pixel past the raster once on it
+        int numSamples = 0;
+        int footprintEnd = -1;
+        int pixel, line;
+        double t;
+        while (numSamples < maxSamples && traversal.next(pixel, line, t)) {
+            bool inside = dsm.containsPixel(pixel, line);
+            if (!inside && footprintEnd < 0 && numSamples > 0 && lanes.cells[static_cast<size_t>(numSamples - 1) * RAY_LANES + lane] >= 0) {
+                footprintEnd = numSamples;
+            }
+            size_t sample = static_cast<size_t>(numSamples++) * RAY_LANES + lane;
+            lanes.cells[sample] = inside ? line * width + pixel : -1;
+            lanes.fractions[sample] = t;
+        }
+        if (footprintEnd < 0) {
+            footprintEnd = numSamples;
+        }
+
+        // Leading samples within MINIMAL_DISTANCE, as GetMinimalDistanceSamples counts them
+        double firstDistance = lanes.fractions[lane] * length;
+        int minimalSamples = 1;
+        while (minimalSamples < numSamples - 1 &&
+               lanes.fractions[static_cast<size_t>(minimalSamples) * RAY_LANES + lane] * length - firstDistance < MINIMAL_DISTANCE) {
+            minimalSamples++;
+        }
+        fill(laneRay.codes, laneRay.codes + minimalSamples, static_cast<uint8_t>(LoSClass::LoS)); // for the first 12m everything is considered LoS
+        laneRay.minimalSamples = minimalSamples;
+
+        size_t peak = static_cast<size_t>(minimalSamples - 1) * RAY_LANES + lane;
+        lanes.peakSlope[lane] = (GetLaneUEElevation(raster, lanes.cells[peak], UE_HEIGHT, noData) - antElevation) * (1.0 / (lanes.fractions[peak] * length));
+        if (std::isnan(lanes.peakSlope[lane])) {
+            lanes.peakSlope[lane] = -numeric_limits<double>::infinity();
+        }
+        lanes.length[lane] = length;
+        lanes.start[lane] = minimalSamples;
+        lanes.end[lane] = max(minimalSamples, footprintEnd);
+        if (laneRay.march) {
+            laneRay.march->footprintEnd = lanes.end[lane];
+        }
+        lanes.first = min(lanes.first, minimalSamples);
+        lanes.numSamples = max(lanes.numSamples, numSamples);
+    }
+
+    bool recordCandidates = rays[laneRays[0]].march != nullptr;
+    LaneParams params = {raster, antElevation, UE_HEIGHT, GetDowntiltSlope(antenna.dt), noData, recordCandidates};
+    visible.assign(lanes.numSamples, 0);
+    candidates.assign(lanes.numSamples, 0);
+    int32_t stop[RAY_LANES];
+    GetLaneKernel()(lanes, params, visible.data(), candidates.data(), stop);
+
+    // Visible samples are LoS or in a building, hidden ones NLoS unless they have no data
+    const BuildingMask* mask = GetBuildingMask();
+    for (int lane = 0; lane < RAY_LANES && lane < lanesUsed; ++lane) {
+        LaneRay& laneRay = rays[laneRays[lane]];
+        const RayGeometry& ray = *laneRay.geometry;
+        uint8_t bit = static_cast<uint8_t>(1 << lane);
+
+        for (int i = lanes.start[lane]; i < stop[lane]; ++i) {
+            size_t sample = static_cast<size_t>(i) * RAY_LANES + lane;
+            if (recordCandidates && (candidates[i] & bit)) {
+                double ueSlope = (GetLaneUEElevation(raster, lanes.cells[sample], UE_HEIGHT, noData) - antElevation) *
+                                 (1.0 / (lanes.fractions[sample] * lanes.length[lane]));
+                laneRay.march->candidates.push_back({i, ueSlope});
+            }
+            int32_t cell = lanes.cells[sample];
+            if (!(visible[i] & bit)) {
+                bool noSampleData = cell < 0 || dsm.isNoData(raster[cell]);
+                laneRay.codes[i] = static_cast<uint8_t>(noSampleData ? LoSClass::NoData : LoSClass::NLoS);
+                continue;
+            }
+
+            bool inBuilding;
+            if (mask != nullptr && cell >= 0) {
+                inBuilding = mask->isBuilding(static_cast<size_t>(cell));
+            } else {
+                double t = lanes.fractions[sample];
+                double structureHeight = GetLaneUEElevation(raster, cell, UE_HEIGHT, noData) - UE_HEIGHT -
+                                         GetGroundElevation(antCoord.first + t * (ray.end.first - antCoord.first),
+                                                            antCoord.second + t * (ray.end.second - antCoord.second));
+                inBuilding = structureHeight > BUILDING_MIN_HEIGHT;
+            }
+            laneRay.codes[i] = static_cast<uint8_t>(inBuilding ? LoSClass::LoSInBuilding : LoSClass::LoS);
+        }
+        fill(laneRay.codes + stop[lane], laneRay.codes + lanes.end[lane], static_cast<uint8_t>(LoSClass::NLoS));
+        fill(laneRay.codes + lanes.end[lane], laneRay.codes + ray.numSamples, static_cast<uint8_t>(LoSClass::NoData));
+    }
+}
+
+bool IsRefinementEnabled() {
+    return MIN_ANGLE_STEP < ANGLE_STEP;
+}
+
+// Builds the DSM pyramid when the next computation walks it: only pixel rays do, and those
+// classified by the lane kernel read every sample instead unless they are refined afterwards.
+void PrepareRayTraversal() {
+    if (traversalMode == TraversalMode::Pixel && (!CanUseLaneKernel() || IsRefinementEnabled())) {
+        buildDsmPyramid();
+    }
+}
+
+bool IsVisible(uint8_t code) {
+    return code == static_cast<uint8_t>(LoSClass::LoS) || code == static_cast<uint8_t>(LoSClass::LoSInBuilding);
+}
+
+// Whether a code tells if the sample is visible, rather than being outside the sector or without data
+bool HasVisibility(uint8_t code) {
+    return code != static_cast<uint8_t>(LoSClass::OutsideRegion) && code != static_cast<uint8_t>(LoSClass::NoData);
+}
+
+// Meters along which two neighbouring rays disagree on visibility. Both profiles are compared
+// every meter, at the same fraction of their length; samples outside the sector or without data
+// are skipped so sector and DSM edges are not refined.
+double GetProfileDisagreement(const uint8_t* codesA, int numSamplesA, const uint8_t* codesB, int numSamplesB) {
+    int positions = static_cast<int>(MAX_HORIZON_DISTANCE * 1000.0);
+    int disagreements = 0;
+    for (int p = 0; p < positions; ++p) {
+        double fraction = (p + 0.5) / positions;
+        uint8_t a = codesA[min(numSamplesA - 1, static_cast<int>(fraction * numSamplesA))];
+        uint8_t b = codesB[min(numSamplesB - 1, static_cast<int>(fraction * numSamplesB))];
+        if (HasVisibility(a) && HasVisibility(b) && IsVisible(a) != IsVisible(b)) {
+            disagreements++;
+        }
+    }
+    return disagreements * MAX_HORIZON_DISTANCE * 1000.0 / positions;
+}
+
+// Progressive raytracing: bisects the gap between neighbouring rays of a computed result where
+// their profiles disagree over more than REFINEMENT_DISTANCE meters, then the new gaps, until they
+// agree or the gap reaches MIN_ANGLE_STEP. classifyRay fills the codes of a new ray, new rays of
+// a round are classified in parallel. Returns the rays sorted by bearing.
+LoSResult RefineRays(const Antenna& antenna, const LoSResult& base, const function<void(const RayGeometry&, uint8_t*)>& classifyRay) {
+    struct RefinedRay {
+        RayGeometry geometry;
+        vector<uint8_t> codes;
+        bool fresh; // Added by the last round, its gaps are not checked yet
+    };
+
+    Coordinate antCoord = base.getOrigin();
+    vector<RefinedRay> rays;
+    for (size_t i = 0; i < base.getNumRays(); ++i) {
+        const uint8_t* codes = base.getRayCodes(i);
+        rays.push_back({base.getRay(i), vector<uint8_t>(codes, codes + base.getNumSamples(i)), true});
+    }
+    const double epsilon = 1e-9;
+
+    while (true) {
+        // Rays stay sorted by bearing, the last gap wraps around north
+        vector<RefinedRay> added;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            const RefinedRay& a = rays[i];
+            const RefinedRay& b = rays[(i + 1) % rays.size()];
+            double gap = b.geometry.bearing - a.geometry.bearing;
+            if (gap <= 0.0) {
+                gap += 360.0;
+            }
+            if ((!a.fresh && !b.fresh) || gap / 2.0 < MIN_ANGLE_STEP - epsilon ||
+                GetProfileDisagreement(a.codes.data(), a.geometry.numSamples, b.codes.data(), b.geometry.numSamples) <= REFINEMENT_DISTANCE) {
+                continue;
+            }
+
+            double bearing = fmod(a.geometry.bearing + gap / 2.0, 360.0);
+            RayGeometry ray = MakeRay(antCoord, bearing, a.geometry.pixelSpace, a.geometry.startPx, a.geometry.startPy);
+            added.push_back({ray, vector<uint8_t>(ray.numSamples), true});
+        }
+        if (added.empty()) {
+            break;
+        }
+
+        TaskGroup rayTasks(GetThreadPool());
+        for (size_t first = 0; first < added.size(); first += RAYS_PER_TASK) {
+            size_t last = std::min(first + RAYS_PER_TASK, added.size());
+            rayTasks.run([&, first, last] {
+                for (size_t i = first; i < last; ++i) {
+                    classifyRay(added[i].geometry, added[i].codes.data());
+                }
+                DsmReader().flushCacheStats();
+                GroundReader().flushCacheStats();
+            });
+        }
+        rayTasks.wait();
+
+        for (RefinedRay& ray : rays) {
+            ray.fresh = false;
+        }
+        for (RefinedRay& ray : added) {
+            rays.push_back(std::move(ray));
+        }
+        sort(rays.begin(), rays.end(), [](const RefinedRay& a, const RefinedRay& b) {
+            return a.geometry.bearing < b.geometry.bearing;
+        });
+    }
+
+    vector<RayGeometry> geometry;
+    for (const RefinedRay& ray : rays) {
+        geometry.push_back(ray.geometry);
+    }
+    LoSResult result(antCoord, std::move(geometry));
+    for (size_t i = 0; i < rays.size(); ++i) {
+        copy(rays[i].codes.begin(), rays[i].codes.end(), result.getRayCodes(i));
+    }
+    cout << "Refined antenna " << antenna.id << " from " << base.getNumRays() << " to " << result.getNumRays() << " rays" << endl;
+    return result;
+}
+
+LoSResult GetPathLoS(Antenna antenna) {
     double antElevation = GetAntennaElevation(antenna);
     cout << "elevation : " << antElevation << endl;
     cout << "Azimut: " << antenna.azimuth << endl;
@@ -114,78 +949,102 @@ Grid GetPathLoS(Antenna antenna) {
 
     auto [lowerBound, upperBound] = calculateBounds(antenna);
 
-    vector<vector<Coordinate>> paths = GetGridPaths(antenna);
-    Grid LoSPaths;
+    LoSResult result(GetAntennaCoordinates(antenna), GetGridPaths(antenna));
+    size_t numRays = result.getNumRays();
 
-    int pathId = 0;
-    for (const auto& path : paths) {
-        vector<CoordinateElevationPair> losPath;
-        double lastPeakElevation = GetElevation(path[MINIMAL_DISTANCE -1].first, path[MINIMAL_DISTANCE -1].second, UE_HEIGHT); //distr(gen);
-        
-        // cout << "last peak elevation: " << lastPeakElevation << endl;
+    // Rays are split in small tasks so idle workers can steal them, letting one tall
+    // antenna (or a run with few antennas) use every core
+    TaskGroup rayTasks(GetThreadPool());
+    for (size_t first = 0; first < numRays; first += RAYS_PER_TASK) {
+        size_t last = std::min(first + RAYS_PER_TASK, numRays);
+        rayTasks.run([&, first, last] {
+            if (CanUseLaneKernel()) {
+                vector<LaneRay> laneRays;
+                for (size_t i = first; i < last; ++i) {
+                    laneRays.push_back({&result.getRay(i), IsInSector(result.getRay(i).bearing, lowerBound, upperBound), result.getRayCodes(i)});
+                }
+                GetLanesLoS(antenna, antElevation, laneRays.data(), laneRays.size());
+            } else {
+                for (size_t i = first; i < last; ++i) {
+                    GetRayLoS(antenna, result.getRay(i), antElevation, IsInSector(result.getRay(i).bearing, lowerBound, upperBound), result.getRayCodes(i));
+                }
+            }
+            DsmReader().flushCacheStats();
+            GroundReader().flushCacheStats();
+        });
+    }
+    rayTasks.wait();
 
-        double lastPeakLat = path[MINIMAL_DISTANCE -1].first;
-        double lastPeakLng = path[MINIMAL_DISTANCE -1].second;
+    if (IsRefinementEnabled()) {
+        result = RefineRays(antenna, result, [&](const RayGeometry& ray, uint8_t* codes) {
+            GetRayLoS(antenna, ray, antElevation, IsInSector(ray.bearing, lowerBound, upperBound), codes);
+        });
+    }
 
-        int index = 0;
-        bool reachedLOSLimit = false;
-        for (const auto& point : path) {
-            
-            if (index < MINIMAL_DISTANCE ) { // for the first 12m everything is considered LoS
-                losPath.push_back({{point.first, point.second}, DEFAULT_LOS_ELEVATION});
-            } else if (pathId > upperBound || pathId < lowerBound) { // If outside working regions for directional antenna
-                losPath.push_back({{point.first, point.second}, DEFAULT_LOS_OUTSIDE_REGION});
-            } else {
+    cout << "success for antenna id : " << antenna.id << endl;
+    
+    return result;
+}
 
-                if (reachedLOSLimit) {
-                    losPath.push_back({{point.first, point.second}, DEFAULT_NLOS_ELEVATION});
-                    continue;
-                    cout << "after continue" << endl;
-                }
-            
-                double UEElevation = GetElevation(point.first, point.second, UE_HEIGHT);
-               
-                double newAngle = 0.0;
-                if (UEElevation > antElevation) {
-
-                    newAngle = calculateNewAngle(antElevation, antenna.lat, antenna.lon, UEElevation, point.first, point.second);
-                    
-                    if (newAngle > antenna.dt || antenna.dt <= 0.0) {
-                        reachedLOSLimit = true;
-                    }
-                }
+// LoS of the sectors of one mast (see groupBySite). Terrain is marched once per ray for all of
+// them, each sector then only applies its mask and downtilt.
+vector<LoSResult> GetSitePathLoS(const vector<Antenna>& sectors) {
+    const Antenna& site = sectors.front();
+    double antElevation = GetAntennaElevation(site);
+    cout << "elevation : " << antElevation << endl;
 
-                double rayElevation = GetRayHeight(antElevation, antenna.lat, antenna.lon, UEElevation, point.first, point.second, lastPeakLat, lastPeakLng);
-
-                if (lastPeakElevation >= rayElevation) {
-                    losPath.push_back({{point.first, point.second}, DEFAULT_NLOS_ELEVATION});
-                    
-                } else {
-
-                    // Compare with ground elevation to check if on a building,
-                    double structureHeight = UEElevation - UE_HEIGHT - GetGroundElevation(point.first, point.second);
-                    // cout << "new angle : " << newAngle << endl;
-                    if (structureHeight > BUILDING_MIN_HEIGHT) {
-                        losPath.push_back({{point.first, point.second}, DEFAULT_LOS_IN_BUILDING});
-                    }
-                    else {
-                        losPath.push_back({{point.first, point.second}, DEFAULT_LOS_ELEVATION});
-                    }
-
-                    lastPeakElevation = UEElevation - UE_HEIGHT;
-                    lastPeakLat = point.first;
-                    lastPeakLng = point.second;
+    vector<pair<double, double>> bounds;
+    for (const Antenna& sector : sectors) {
+        cout << "Azimut: " << sector.azimuth << endl;
+        cout << "dt: " << sector.dt << endl;
+        auto [lowerBound, upperBound] = calculateBounds(sector);
+        bounds.push_back({lowerBound, upperBound});
+    }
+
+    vector<RayGeometry> rays = GetGridPaths(site);
+    size_t numRays = rays.size();
+    LoSResult siteResult(GetAntennaCoordinates(site), rays);
+    vector<int> minimalSamples(numRays);
+    vector<SiteMarch> marches(numRays);
+
+    TaskGroup rayTasks(GetThreadPool());
+    for (size_t first = 0; first < numRays; first += RAYS_PER_TASK) {
+        size_t last = std::min(first + RAYS_PER_TASK, numRays);
+        rayTasks.run([&, first, last] {
+            vector<LaneRay> laneRays;
+            for (size_t i = first; i < last; ++i) {
+                bool inAnySector = false;
+                for (const auto& [lowerBound, upperBound] : bounds) {
+                    inAnySector = inAnySector || IsInSector(rays[i].bearing, lowerBound, upperBound);
+                }
+                laneRays.push_back({&rays[i], inAnySector, siteResult.getRayCodes(i), &marches[i]});
+            }
+            if (CanUseLaneKernel()) {
+                GetLanesLoS(site, antElevation, laneRays.data(), laneRays.size());
+            } else {
+                for (LaneRay& ray : laneRays) {
+                    ray.minimalSamples = GetRayLoS(site, *ray.geometry, antElevation, ray.inSector, ray.codes, ray.march);
                 }
-                
             }
+            for (size_t i = first; i < last; ++i) {
+                minimalSamples[i] = laneRays[i - first].minimalSamples;
+            }
+            DsmReader().flushCacheStats();
+            GroundReader().flushCacheStats();
+        });
+    }
+    rayTasks.wait();
 
-            index += 1;
+    vector<LoSResult> results;
+    for (size_t s = 0; s < sectors.size(); ++s) {
+        LoSResult result(GetAntennaCoordinates(site), rays);
+        for (size_t i = 0; i < numRays; ++i) {
+            ApplySectorToRay(siteResult.getRayCodes(i), rays[i].numSamples, minimalSamples[i], marches[i],
+                             IsInSector(rays[i].bearing, bounds[s].first, bounds[s].second), sectors[s].dt, result.getRayCodes(i));
         }
-        LoSPaths.push_back(losPath);
-        pathId += 1;
+        results.push_back(std::move(result));
+        cout << "success for antenna id : " << sectors[s].id << endl;
     }
 
-    cout << "success for antenna id : " << antenna.id << endl;
-    
-    return LoSPaths;
-}
\ No newline at end of file
+    return results;
+}
@@ -0,0 +1,319 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define GLOSS_X86_64 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GLOSS_TARGET_AVX2
+#else
+#define GLOSS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Lockstep sight-line kernel: the pixel rays of one task are classified together, one sample of
+// every ray at a time. Elevations are gathered from the in-memory DSM, and the slope tests of
+// GetRayLoS are done on all the rays at once. The instruction set is picked at runtime, so one
+// build runs AVX2 where available, SSE2 on any other x86-64 CPU and plain C++ elsewhere.
+// SetLaneKernel can force a narrower one, so every kernel can be tested on one machine.
+// Samples without data (outside the DSM or on a nodata pixel) get a NaN elevation: they are
+// never visible, never a peak and never reach the downtilt limit.
+
+const int RAY_LANES = 8; // Rays classified together, one per lane
+
+// Samples of up to RAY_LANES pixel rays, interleaved: sample i of lane l is at i * RAY_LANES + l.
+// Samples before start, or after the end of a lane, are never classified.
+struct RayLanes {
+    std::vector<int32_t> cells;    // Row-major DSM index of the sample pixel, -1 outside the raster
+    std::vector<double> fractions; // Position of the sample along its ray, 0 at the antenna and 1 at the end
+    int32_t start[RAY_LANES];      // First sample classified, after the leading LoS samples
+    int32_t end[RAY_LANES];        // Sample count of the ray, start for an unused lane
+    double length[RAY_LANES];      // Ray length in meters
+    double peakSlope[RAY_LANES];   // Slope of the first peak
+    int first = 0;                 // Smallest start
+    int numSamples = 0;            // Largest end
+};
+
+struct LaneParams {
+    const float* raster;
+    double antElevation;
+    double ueHeight;
+    double downtiltSlope;
+    float noData; // Nodata value of the DSM
+    bool recordCandidates; // Record downtilt candidates instead of stopping at the downtilt limit
+};
+
+// Per sample, bit l is set when lane l is visible (visible) or a downtilt candidate (candidates).
+// stop[l] is the sample after the one reaching the downtilt limit, or the end of the lane.
+using LaneKernel = void (*)(const RayLanes& lanes, const LaneParams& params, uint8_t* visible, uint8_t* candidates, int32_t* stop);
+
+// UE elevation over a DSM cell, as GetElevationAtPixel computes it: NaN without data
+inline double GetLaneUEElevation(const float* raster, int32_t cell, double ueHeight, float noData) {
+    float elevation = cell >= 0 ? raster[cell] : NO_ELEVATION;
+    return elevation == noData ? NO_ELEVATION : elevation + ueHeight;
+}
+
+void ClassifyLanesScalar(const RayLanes& lanes, const LaneParams& params, uint8_t* visible, uint8_t* candidates, int32_t* stop) {
+    double peak[RAY_LANES];
+    double candidateSlope[RAY_LANES];
+    for (int lane = 0; lane < RAY_LANES; ++lane) {
+        peak[lane] = lanes.peakSlope[lane];
+        candidateSlope[lane] = 0.0;
+        stop[lane] = lanes.end[lane];
+    }
+
+    for (int i = lanes.first; i < lanes.numSamples; ++i) {
+        uint8_t visibleBits = 0;
+        uint8_t candidateBits = 0;
+        for (int lane = 0; lane < RAY_LANES; ++lane) {
+            if (i < lanes.start[lane] || i >= stop[lane]) {
+                continue;
+            }
+            size_t sample = static_cast<size_t>(i) * RAY_LANES + lane;
+            double ueElevation = GetLaneUEElevation(params.raster, lanes.cells[sample], params.ueHeight, params.noData);
+            double inverseDistance = 1.0 / (lanes.fractions[sample] * lanes.length[lane]);
+            double ueSlope = (ueElevation - params.antElevation) * inverseDistance;
+
+            if (params.recordCandidates) {
+                if (ueSlope > candidateSlope[lane]) {
+                    candidateBits |= 1 << lane;
+                    candidateSlope[lane] = ueSlope;
+                }
+            } else if (ueSlope > params.downtiltSlope) {
+                stop[lane] = i + 1;
+            }
+
+            if (!(peak[lane] >= ueSlope) && !std::isnan(ueSlope)) {
+                visibleBits |= 1 << lane;
+                peak[lane] = (ueElevation - params.ueHeight - params.antElevation) * inverseDistance;
+            }
+        }
+        visible[i] = visibleBits;
+        candidates[i] = candidateBits;
+    }
+}
+
+#ifdef GLOSS_X86_64
+
+// Two lanes per register, elevations are loaded one by one
+void ClassifyLanesSse2(const RayLanes& lanes, const LaneParams& params, uint8_t* visible, uint8_t* candidates, int32_t* stop) {
+    const int PAIRS = RAY_LANES / 2;
+    const __m128d antElevation = _mm_set1_pd(params.antElevation);
+    const __m128d ueHeight = _mm_set1_pd(params.ueHeight);
+    const __m128d downtiltSlope = _mm_set1_pd(params.downtiltSlope);
+    const __m128d noData = _mm_set1_pd(params.noData);
+    const __m128d noDataUE = _mm_set1_pd(NO_ELEVATION);
+    const __m128d one = _mm_set1_pd(1.0);
+
+    __m128d length[PAIRS], peak[PAIRS], candidateSlope[PAIRS];
+    for (int pair = 0; pair < PAIRS; ++pair) {
+        length[pair] = _mm_loadu_pd(lanes.length + 2 * pair);
+        peak[pair] = _mm_loadu_pd(lanes.peakSlope + 2 * pair);
+        candidateSlope[pair] = _mm_setzero_pd();
+    }
+    for (int lane = 0; lane < RAY_LANES; ++lane) {
+        stop[lane] = lanes.end[lane];
+    }
+    const __m128i startLow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.start));
+    const __m128i startHigh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes.start + 4));
+
+    for (int i = lanes.first; i < lanes.numSamples; ++i) {
+        // start <= i < stop, widened to one mask per double
+        __m128i index = _mm_set1_epi32(i);
+        __m128i activeLow = _mm_andnot_si128(_mm_cmpgt_epi32(startLow, index),
+                                             _mm_cmpgt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stop)), index));
+        __m128i activeHigh = _mm_andnot_si128(_mm_cmpgt_epi32(startHigh, index),
+                                              _mm_cmpgt_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(stop + 4)), index));
+        __m128d active[PAIRS] = {_mm_castsi128_pd(_mm_unpacklo_epi32(activeLow, activeLow)),
+                                 _mm_castsi128_pd(_mm_unpackhi_epi32(activeLow, activeLow)),
+                                 _mm_castsi128_pd(_mm_unpacklo_epi32(activeHigh, activeHigh)),
+                                 _mm_castsi128_pd(_mm_unpackhi_epi32(activeHigh, activeHigh))};
+
+        const int32_t* cells = lanes.cells.data() + static_cast<size_t>(i) * RAY_LANES;
+        const double* fractions = lanes.fractions.data() + static_cast<size_t>(i) * RAY_LANES;
+        int visibleBits = 0;
+        int candidateBits = 0;
+        int reachedBits = 0;
+        for (int pair = 0; pair < PAIRS; ++pair) {
+            int32_t cellA = cells[2 * pair];
+            int32_t cellB = cells[2 * pair + 1];
+            __m128d elevation = _mm_set_pd(cellB >= 0 ? params.raster[cellB] : NO_ELEVATION,
+                                           cellA >= 0 ? params.raster[cellA] : NO_ELEVATION);
+            __m128d isNoData = _mm_cmpeq_pd(elevation, noData);
+            __m128d ueElevation = _mm_or_pd(_mm_and_pd(isNoData, noDataUE), _mm_andnot_pd(isNoData, _mm_add_pd(elevation, ueHeight)));
+            __m128d inverseDistance = _mm_div_pd(one, _mm_mul_pd(_mm_loadu_pd(fractions + 2 * pair), length[pair]));
+            __m128d ueSlope = _mm_mul_pd(_mm_sub_pd(ueElevation, antElevation), inverseDistance);
+
+            if (params.recordCandidates) {
+                __m128d candidate = _mm_and_pd(_mm_cmpgt_pd(ueSlope, candidateSlope[pair]), active[pair]);
+                candidateSlope[pair] = _mm_or_pd(_mm_and_pd(candidate, ueSlope), _mm_andnot_pd(candidate, candidateSlope[pair]));
+                candidateBits |= _mm_movemask_pd(candidate) << (2 * pair);
+            } else {
+                reachedBits |= _mm_movemask_pd(_mm_and_pd(_mm_cmpgt_pd(ueSlope, downtiltSlope), active[pair])) << (2 * pair);
+            }
+
+            __m128d isVisible = _mm_and_pd(_mm_and_pd(_mm_cmpnge_pd(peak[pair], ueSlope), _mm_cmpord_pd(ueSlope, ueSlope)), active[pair]);
+            __m128d newPeak = _mm_mul_pd(_mm_sub_pd(_mm_sub_pd(ueElevation, ueHeight), antElevation), inverseDistance);
+            peak[pair] = _mm_or_pd(_mm_and_pd(isVisible, newPeak), _mm_andnot_pd(isVisible, peak[pair]));
+            visibleBits |= _mm_movemask_pd(isVisible) << (2 * pair);
+        }
+
+        for (int lane = 0; reachedBits != 0; ++lane, reachedBits >>= 1) {
+            if (reachedBits & 1) {
+                stop[lane] = i + 1;
+            }
+        }
+        visible[i] = static_cast<uint8_t>(visibleBits);
+        candidates[i] = static_cast<uint8_t>(candidateBits);
+    }
+}
+
+// Four lanes per register, elevations are gathered eight at a time
+GLOSS_TARGET_AVX2
+void ClassifyLanesAvx2(const RayLanes& lanes, const LaneParams& params, uint8_t* visible, uint8_t* candidates, int32_t* stop) {
+    const int HALVES = RAY_LANES / 4;
+    const __m256d antElevation = _mm256_set1_pd(params.antElevation);
+    const __m256d ueHeight = _mm256_set1_pd(params.ueHeight);
+    const __m256d downtiltSlope = _mm256_set1_pd(params.downtiltSlope);
+    const __m256d noData = _mm256_set1_pd(params.noData);
+    const __m256d noDataUE = _mm256_set1_pd(NO_ELEVATION);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256 outside = _mm256_set1_ps(NO_ELEVATION);
+    const __m256i noCell = _mm256_set1_epi32(-1);
+
+    __m256d length[HALVES], peak[HALVES], candidateSlope[HALVES];
+    for (int half = 0; half < HALVES; ++half) {
+        length[half] = _mm256_loadu_pd(lanes.length + 4 * half);
+        peak[half] = _mm256_loadu_pd(lanes.peakSlope + 4 * half);
+        candidateSlope[half] = _mm256_setzero_pd();
+    }
+    for (int lane = 0; lane < RAY_LANES; ++lane) {
+        stop[lane] = lanes.end[lane];
+    }
+    const __m256i start = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes.start));
+    __m256i stopLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stop));
+
+    for (int i = lanes.first; i < lanes.numSamples; ++i) {
+        // start <= i < stop, widened to one mask per double
+        __m256i index = _mm256_set1_epi32(i);
+        __m256i activeLanes = _mm256_andnot_si256(_mm256_cmpgt_epi32(start, index), _mm256_cmpgt_epi32(stopLanes, index));
+        __m256d active[HALVES] = {_mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(activeLanes))),
+                                  _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(activeLanes, 1)))};
+
+        __m256i cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes.cells.data() + static_cast<size_t>(i) * RAY_LANES));
+        __m256 inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(cells, noCell));
+        __m256 elevations = _mm256_mask_i32gather_ps(outside, params.raster, cells, inside, 4);
+        __m128 elevationHalves[HALVES] = {_mm256_castps256_ps128(elevations), _mm256_extractf128_ps(elevations, 1)};
+
+        const double* fractions = lanes.fractions.data() + static_cast<size_t>(i) * RAY_LANES;
+        int visibleBits = 0;
+        int candidateBits = 0;
+        int reachedBits = 0;
+        for (int half = 0; half < HALVES; ++half) {
+            __m256d elevation = _mm256_cvtps_pd(elevationHalves[half]);
+            __m256d ueElevation = _mm256_blendv_pd(_mm256_add_pd(elevation, ueHeight), noDataUE, _mm256_cmp_pd(elevation, noData, _CMP_EQ_OQ));
+            __m256d inverseDistance = _mm256_div_pd(one, _mm256_mul_pd(_mm256_loadu_pd(fractions + 4 * half), length[half]));
+            __m256d ueSlope = _mm256_mul_pd(_mm256_sub_pd(ueElevation, antElevation), inverseDistance);
+
+            if (params.recordCandidates) {
+                __m256d candidate = _mm256_and_pd(_mm256_cmp_pd(ueSlope, candidateSlope[half], _CMP_GT_OQ), active[half]);
+                candidateSlope[half] = _mm256_blendv_pd(candidateSlope[half], ueSlope, candidate);
+                candidateBits |= _mm256_movemask_pd(candidate) << (4 * half);
+            } else {
+                reachedBits |= _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(ueSlope, downtiltSlope, _CMP_GT_OQ), active[half])) << (4 * half);
+            }
+
+            __m256d hasData = _mm256_cmp_pd(ueSlope, ueSlope, _CMP_ORD_Q);
+            __m256d isVisible = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(peak[half], ueSlope, _CMP_NGE_UQ), hasData), active[half]);
+            __m256d newPeak = _mm256_mul_pd(_mm256_sub_pd(_mm256_sub_pd(ueElevation, ueHeight), antElevation), inverseDistance);
+            peak[half] = _mm256_blendv_pd(peak[half], newPeak, isVisible);
+            visibleBits |= _mm256_movemask_pd(isVisible) << (4 * half);
+        }
+
+        if (reachedBits != 0) {
+            for (int lane = 0; lane < RAY_LANES; ++lane) {
+                if (reachedBits & (1 << lane)) {
+                    stop[lane] = i + 1;
+                }
+            }
+            stopLanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stop));
+        }
+        visible[i] = static_cast<uint8_t>(visibleBits);
+        candidates[i] = static_cast<uint8_t>(candidateBits);
+    }
+}
+
+bool CpuSupportsAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // GLOSS_X86_64
+
+struct LaneKernelChoice {
+    LaneKernel kernel;
+    const char* name;
+};
+
+// Kernels the CPU runs, widest first
+const std::vector<LaneKernelChoice>& GetLaneKernelChoices() {
+    static const std::vector<LaneKernelChoice> choices = [] {
+        std::vector<LaneKernelChoice> available;
+#ifdef GLOSS_X86_64
+        if (CpuSupportsAvx2()) {
+            available.push_back({ClassifyLanesAvx2, "avx2"});
+        }
+        available.push_back({ClassifyLanesSse2, "sse2"});
+#endif
+        available.push_back({ClassifyLanesScalar, "scalar"});
+        return available;
+    }();
+    return choices;
+}
+
+// Set by SetLaneKernel, the widest kernel otherwise. Atomic as workers of a running computation read it.
+std::atomic<const LaneKernelChoice*> forcedLaneKernel{nullptr};
+
+const LaneKernelChoice& GetLaneKernelChoice() {
+    const LaneKernelChoice* forced = forcedLaneKernel.load(std::memory_order_acquire);
+    return forced != nullptr ? *forced : GetLaneKernelChoices().front();
+}
+
+// Forces one kernel by name, to compare them on the same machine. "auto" restores the widest one.
+void SetLaneKernel(const std::string& name) {
+    if (name == "auto") {
+        forcedLaneKernel.store(nullptr, std::memory_order_release);
+        return;
+    }
+    for (const LaneKernelChoice& choice : GetLaneKernelChoices()) {
+        if (name == choice.name) {
+            forcedLaneKernel.store(&choice, std::memory_order_release);
+            return;
+        }
+    }
+    throw std::runtime_error("Ray kernel \"" + name + "\" is not available on this CPU.");
+}
+
+LaneKernel GetLaneKernel() {
+    return GetLaneKernelChoice().kernel;
+}
+
+const char* GetLaneKernelName() {
+    return GetLaneKernelChoice().name;
+}
@@ -1,52 +1,131 @@
-#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include <string>
-#include <fstream>
-#include <iostream>
+#include <string_view>
+#include <vector>
 #include "csvfile.h"
 
-// Read csv into a vector of vector of strings
-csvFile::csvFile(char separator, std::string filename): 
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Map the whole csv read-only. Lines are only split when read.
+csvFile::csvFile(char separator, std::string filename):
         separator_(separator), filename_(filename)
 {
-	// Open file
-	std::ifstream file ( filename );
-	if (file.good()) {
-		std::string line = "";
-		size_t pos = 0;
-
-        // Bool to check if file is empty
-        bool emptyFile = true;
-        // Read all lines in the csv
-        while (std::getline(file, line)) {
-            emptyFile = false;
-            std::vector<std::string> lineVec;
-            do {
-                pos = line.find(separator); // Find separator
-                // push_back string up till separator
-                lineVec.push_back( line.substr(0, pos) );
-                // erase pushed-backed string and the separator
-                line.erase(0, pos + 1);
-            } while ( pos != std::string::npos);
-            // Push back line vector
-            data_.push_back(lineVec);
+#ifdef _WIN32
+    fileHandle_ = CreateFileA(filename_.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle_ == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error reading " + filename_);
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(fileHandle_, &size);
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ > 0) {
+        mappingHandle_ = CreateFileMappingA(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data_ = mappingHandle_ ? static_cast<const char*>(MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    }
+#else
+    int fd = open(filename_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Error reading " + filename_);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Error reading " + filename_);
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if (size_ > 0) {
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        data_ = mapping == MAP_FAILED ? nullptr : static_cast<const char*>(mapping);
+        if (data_) {
+            madvise(mapping, size_, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+#endif
+    if (size_ == 0) {
+        unmap();
+        throw std::runtime_error(filename_ + " is empty!");
+    }
+    if (data_ == nullptr) {
+        unmap();
+        throw std::runtime_error("Failed to map " + filename_);
+    }
+
+    // Skip a UTF-8 byte order mark
+    if (size_ >= 3 && std::memcmp(data_, "\xEF\xBB\xBF", 3) == 0) {
+        position_ = 3;
+    }
+}
+
+csvFile::~csvFile()
+{
+    unmap();
+}
+
+void csvFile::unmap()
+{
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mappingHandle_) CloseHandle(mappingHandle_);
+    if (fileHandle_ != INVALID_HANDLE_VALUE) CloseHandle(fileHandle_);
+    mappingHandle_ = nullptr;
+    fileHandle_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+    data_ = nullptr;
+}
+
+bool csvFile::readLine(std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    while (position_ < size_) {
+        const char* begin = data_ + position_;
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', size_ - position_));
+        const char* end = newline ? newline : data_ + size_;
+        position_ = newline ? position_ + (newline - begin) + 1 : size_;
+        lineNumber_++;
+
+        // Windows line endings
+        if (end > begin && end[-1] == '\r') {
+            end--;
+        }
+        if (end == begin) {
+            continue;
         }
-        if (emptyFile) {
-            std::cout << filename << " is empty!\n";
-            std::exit(EXIT_FAILURE);
+
+        const char* field = begin;
+        while (true) {
+            const char* separator = std::find(field, end, separator_);
+            fields.emplace_back(field, static_cast<size_t>(separator - field));
+            if (separator == end) {
+                break;
+            }
+            field = separator + 1;
         }
+        return true;
     }
-	else {
-		std::cout << "Error reading " << filename;
-		std::exit(EXIT_FAILURE);
-	}
-}  
+    return false;
+}
 
-std::string csvFile::getFilename() const
+size_t csvFile::getLineNumber() const
 {
-    return filename_;
+    return lineNumber_;
+}
+
+size_t csvFile::countLines() const
+{
+    return static_cast<size_t>(std::count(data_ + position_, data_ + size_, '\n')) + 1;
 }
 
-std::vector<std::vector<std::string>>* csvFile::getData()
+std::string csvFile::getFilename() const
 {
-    return &data_;
-}
\ No newline at end of file
+    return filename_;
+}
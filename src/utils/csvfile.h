@@ -2,24 +2,50 @@
 #define CSVFILE_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
-// Implementaion of a csv reader into an object
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+// Read-only memory mapping of a csv file, split into fields in place: no line or field is copied
 class csvFile
 {
 public:
-    // Read csv file with separator and a given filename
+    // Map csv file with separator and a given filename
     csvFile(char separator, std::string filename);
 
-    // Returns the csv file data in a vector of a vector of strings
-    std::vector<std::vector<std::string>>* getData();
+    csvFile(const csvFile&) = delete;
+    csvFile& operator=(const csvFile&) = delete;
+
+    ~csvFile();
+
+    // Splits the next non-blank line into fields, views into the mapping valid as long as the file.
+    // Returns false past the last line.
+    bool readLine(std::vector<std::string_view>& fields);
+
+    // Number of the line returned by the last readLine, from 1
+    size_t getLineNumber() const;
+
+    // Upper bound on the number of lines, to reserve records before reading them
+    size_t countLines() const;
 
     std::string getFilename() const;
 
 private:
+    void unmap();
+
     char separator_;
     std::string filename_;
-    std::vector<std::vector<std::string>> data_;
+#ifdef _WIN32
+    HANDLE fileHandle_ = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle_ = nullptr;
+#endif
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t position_ = 0;
+    size_t lineNumber_ = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,458 @@
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#include "gridpaths.cpp"
+#include "classes/sweep_tree.cpp"
+#include "classes/coverage.cpp"
+
+const int VIEWSHED_WEDGES = 360;  // Angular slices of the sweep, each one swept by its own pool task
+const int VIEWSHED_BAND_ROWS = 64; // Raster rows bucketed by one pool task
+const double FRAME_STEP_KM = 0.1;  // Offset used to measure the pixel size around the antenna
+
+// Rays casts ANGLE_STEP rays and samples them (see GetPathLoS), Viewshed classifies every DSM
+// cell around the antenna with a radial sweep (see GetViewshedLoS) and returns rasters.
+enum class LoSEngine { Rays, Viewshed };
+LoSEngine losEngine = LoSEngine::Rays;
+
+// Local linear map between DSM pixels and meters east/north of the antenna, measured by
+// projecting two points FRAME_STEP_KM away. Exact for projected rasters, a tangent plane
+// approximation for geographic ones.
+struct PixelFrame {
+    double originPx = 0.0;
+    double originPy = 0.0;
+    double pixelsPerMeter[2][2] = {}; // (pixel, line) offset = pixelsPerMeter * (east, north)
+    double metersPerPixel[2][2] = {}; // Its inverse
+
+    bool init(const Coordinate& antenna) {
+        ElevationReader& dsm = DsmReader();
+        Coordinate east = CalculateDestination(antenna.first, antenna.second, 90.0, FRAME_STEP_KM);
+        Coordinate north = CalculateDestination(antenna.first, antenna.second, 0.0, FRAME_STEP_KM);
+        double eastPx, eastPy, northPx, northPy;
+        if (!dsm.toPixelSpace(antenna.first, antenna.second, originPx, originPy) ||
+            !dsm.toPixelSpace(east.first, east.second, eastPx, eastPy) ||
+            !dsm.toPixelSpace(north.first, north.second, northPx, northPy)) {
+            return false;
+        }
+
+        double step = FRAME_STEP_KM * 1000.0;
+        pixelsPerMeter[0][0] = (eastPx - originPx) / step;
+        pixelsPerMeter[1][0] = (eastPy - originPy) / step;
+        pixelsPerMeter[0][1] = (northPx - originPx) / step;
+        pixelsPerMeter[1][1] = (northPy - originPy) / step;
+        double determinant = pixelsPerMeter[0][0] * pixelsPerMeter[1][1] - pixelsPerMeter[0][1] * pixelsPerMeter[1][0];
+        if (!(std::abs(determinant) > 0.0)) {
+            return false;
+        }
+        metersPerPixel[0][0] = pixelsPerMeter[1][1] / determinant;
+        metersPerPixel[0][1] = -pixelsPerMeter[0][1] / determinant;
+        metersPerPixel[1][0] = -pixelsPerMeter[1][0] / determinant;
+        metersPerPixel[1][1] = pixelsPerMeter[0][0] / determinant;
+        return true;
+    }
+
+    // Meters east and north of the antenna of a pixel/line offset
+    void toMeters(double dx, double dy, double& east, double& north) const {
+        east = metersPerPixel[0][0] * dx + metersPerPixel[0][1] * dy;
+        north = metersPerPixel[1][0] * dx + metersPerPixel[1][1] * dy;
+    }
+
+    void toPixels(double east, double north, double& px, double& py) const {
+        px = originPx + pixelsPerMeter[0][0] * east + pixelsPerMeter[0][1] * north;
+        py = originPy + pixelsPerMeter[1][0] * east + pixelsPerMeter[1][1] * north;
+    }
+};
+
+const double PSEUDO_TURN = 4.0; // Full turn of PseudoAngle
+
+// Angle of a pixel space direction in [0, PSEUDO_TURN), growing with the true angle (the diamond
+// angle). The sweep only needs to order directions, so this replaces atan2. NaN for (0, 0).
+double PseudoAngle(double dx, double dy) {
+    if (dy >= 0.0) {
+        return dx >= 0.0 ? dy / (dx + dy) : 1.0 - dx / (dy - dx);
+    }
+    return dx < 0.0 ? 2.0 - dy / (-dx - dy) : 3.0 + dx / (dx - dy);
+}
+
+// Geometry of one cell seen from the antenna. Angles are pseudo-angles in pixel space, where the
+// sweep runs, distances are in meters.
+struct CellSpan {
+    double distance;
+    double east;
+    double north;
+    double center; // Angle of the cell center in [0, PSEUDO_TURN)
+    double low;    // Angular extent of the cell, low <= center <= high, may leave [0, PSEUDO_TURN)
+    double high;
+
+    // Degrees clockwise from north, as the ray bearings
+    double bearing() const {
+        double degrees = std::atan2(east, north) * 180.0 / M_PI;
+        return degrees < 0.0 ? degrees + 360.0 : degrees;
+    }
+};
+
+CellSpan GetCellSpan(const PixelFrame& frame, int pixel, int line) {
+    double dx = pixel + 0.5 - frame.originPx;
+    double dy = line + 0.5 - frame.originPy;
+
+    CellSpan span;
+    frame.toMeters(dx, dy, span.east, span.north);
+    span.distance = std::hypot(span.east, span.north);
+    span.center = PseudoAngle(dx, dy);
+    span.low = span.high = span.center;
+    for (double cornerX : {dx - 0.5, dx + 0.5}) {
+        for (double cornerY : {dy - 0.5, dy + 0.5}) {
+            if (cornerX == 0.0 && cornerY == 0.0) {
+                continue;
+            }
+            double offset = std::remainder(PseudoAngle(cornerX, cornerY) - span.center, PSEUDO_TURN);
+            span.low = std::min(span.low, span.center + offset);
+            span.high = std::max(span.high, span.center + offset);
+        }
+    }
+    return span;
+}
+
+// Pixels of the DSM around the antenna holding the cells in its sector, up to MAX_HORIZON_DISTANCE
+gloss::RasterWindow GetSectorWindow(const PixelFrame& frame, double lowerBound, double upperBound) {
+    double radius = MAX_HORIZON_DISTANCE * 1000.0;
+    double minPx = frame.originPx, maxPx = frame.originPx;
+    double minPy = frame.originPy, maxPy = frame.originPy;
+    auto include = [&](double east, double north) {
+        double px, py;
+        frame.toPixels(east, north, px, py);
+        minPx = std::min(minPx, px);
+        maxPx = std::max(maxPx, px);
+        minPy = std::min(minPy, py);
+        maxPy = std::max(maxPy, py);
+    };
+
+    // Cells under MINIMAL_DISTANCE are LoS whatever the sector
+    for (double east : {-1.0, 1.0}) {
+        for (double north : {-1.0, 1.0}) {
+            include(east * MINIMAL_DISTANCE, north * MINIMAL_DISTANCE);
+        }
+    }
+    for (double bearing = lowerBound; bearing < upperBound + ANGLE_STEP; bearing += ANGLE_STEP) {
+        double angle = std::min(bearing, upperBound) * M_PI / 180.0;
+        include(radius * std::sin(angle), radius * std::cos(angle));
+    }
+
+    ElevationReader& dsm = DsmReader();
+    int firstPixel = std::max(0, static_cast<int>(std::floor(minPx)) - 1);
+    int firstLine = std::max(0, static_cast<int>(std::floor(minPy)) - 1);
+    int lastPixel = std::min(dsm.getWidth(), static_cast<int>(std::ceil(maxPx)) + 1);
+    int lastLine = std::min(dsm.getHeight(), static_cast<int>(std::ceil(maxPy)) + 1);
+
+    gloss::RasterWindow window;
+    window.xOff = firstPixel;
+    window.yOff = firstLine;
+    window.width = std::max(0, lastPixel - firstPixel);
+    window.height = std::max(0, lastLine - firstLine);
+    std::copy(dsm.getGeoTransform(), dsm.getGeoTransform() + 6, window.geoTransform);
+    return window;
+}
+
+// Ground elevation under a cell, read at the same pixel when both rasters share their grid
+double GetCellGroundElevation(int pixel, int line, const Coordinate& antenna, const CellSpan& span, bool sameGrid) {
+    if (sameGrid) {
+        ElevationReader& ground = GroundReader();
+        float gndElevation = ground.getElevationAtPixel(pixel, line);
+        return ground.isNoData(gndElevation) ? NO_ELEVATION : gndElevation;
+    }
+    Coordinate point = CalculateDestination(antenna.first, antenna.second, span.bearing(), span.distance / 1000.0);
+    return GetGroundElevation(point.first, point.second);
+}
+
+// Whether a visible cell is in a building: one lookup in the building mask, or without it, the ground
+// elevation read at the same pixel when both rasters share their grid
+bool IsCellInBuilding(int pixel, int line, double ueElevation, const Coordinate& antenna, const CellSpan& span, bool sameGrid) {
+    if (const BuildingMask* mask = GetBuildingMask()) {
+        return mask->isBuilding(pixel, line);
+    }
+    return ueElevation - UE_HEIGHT - GetCellGroundElevation(pixel, line, antenna, span, sameGrid) > BUILDING_MIN_HEIGHT;
+}
+
+// Exact viewshed of one antenna over the cells of its sector (Van Kreveld's radial sweep).
+// A line from the antenna sweeps around it; the cells it crosses are kept in a SweepTree
+// ordered by distance, so when it reaches the center of a cell, the steepest cell in front
+// of it is known in O(log n) and the whole sweep costs O(n log n) for n cells.
+// A cell is seen when a UE standing on it rises over the slope of every cell in front, the
+// same test as the ray engine made against every cell instead of the last peak only. Cells
+// after one reaching the downtilt limit are NLoS, cells under MINIMAL_DISTANCE are LoS and
+// cells outside the sector OutsideRegion and nodata cells NoData, as on rays.
+// The sweep is split in VIEWSHED_WEDGES slices, each seeded with the cells already crossing
+// its first angle, so slices run on any thread.
+LoSResult GetViewshedLoS(Antenna antenna) {
+    double antElevation = GetAntennaElevation(antenna);
+    cout << "elevation : " << antElevation << endl;
+    cout << "Azimut: " << antenna.azimuth << endl;
+    cout << "dt: " << antenna.dt << endl;
+
+    auto [lowerBound, upperBound] = calculateBounds(antenna);
+    Coordinate antCoord = GetAntennaCoordinates(antenna);
+
+    PixelFrame frame;
+    if (!frame.init(antCoord)) {
+        throw std::runtime_error("Failed to project antenna " + std::to_string(antenna.id) + " on the DSM.");
+    }
+    LoSResult result(antCoord, GetSectorWindow(frame, lowerBound, upperBound));
+    const gloss::RasterWindow& window = result.getRasterWindow();
+    if (window.width == 0 || window.height == 0) {
+        cout << "success for antenna id : " << antenna.id << endl;
+        return result;
+    }
+
+    double radius = MAX_HORIZON_DISTANCE * 1000.0;
+    double wedgeAngle = PSEUDO_TURN / VIEWSHED_WEDGES;
+    int antennaPixel = static_cast<int>(std::floor(frame.originPx));
+    int antennaLine = static_cast<int>(std::floor(frame.originPy));
+    auto isSwept = [&](int pixel, int line, const CellSpan& span) {
+        return span.distance >= MINIMAL_DISTANCE && span.distance <= radius && (pixel != antennaPixel || line != antennaLine);
+    };
+    auto wedgeOf = [&](double angle) {
+        int wedge = static_cast<int>(std::floor(angle / wedgeAngle)) % VIEWSHED_WEDGES;
+        return wedge < 0 ? wedge + VIEWSHED_WEDGES : wedge;
+    };
+    auto forEachWedge = [&](const CellSpan& span, auto&& visit) {
+        int first = static_cast<int>(std::floor(span.low / wedgeAngle));
+        int last = static_cast<int>(std::floor(span.high / wedgeAngle));
+        for (int wedge = first; wedge <= last && wedge < first + VIEWSHED_WEDGES; ++wedge) {
+            visit(((wedge % VIEWSHED_WEDGES) + VIEWSHED_WEDGES) % VIEWSHED_WEDGES);
+        }
+    };
+
+    // Cells are bucketed by the slices they cross, in two passes over bands of rows (count, then fill).
+    // Cells that aren't swept get their class right away.
+    int numBands = (window.height + VIEWSHED_BAND_ROWS - 1) / VIEWSHED_BAND_ROWS;
+    vector<vector<uint32_t>> bandCounts(numBands, vector<uint32_t>(VIEWSHED_WEDGES, 0));
+    vector<vector<uint8_t>> bandTargets(numBands, vector<uint8_t>(VIEWSHED_WEDGES, 0));
+    {
+        TaskGroup bandTasks(GetThreadPool());
+        for (int band = 0; band < numBands; ++band) {
+            bandTasks.run([&, band] {
+                int lastRow = std::min(window.height, (band + 1) * VIEWSHED_BAND_ROWS);
+                for (int row = band * VIEWSHED_BAND_ROWS; row < lastRow; ++row) {
+                    uint8_t* codes = result.getRowCodes(row);
+                    for (int column = 0; column < window.width; ++column) {
+                        int pixel = window.xOff + column;
+                        int line = window.yOff + row;
+                        CellSpan span = GetCellSpan(frame, pixel, line);
+                        if (span.distance > radius) {
+                            continue;
+                        }
+                        if (!isSwept(pixel, line, span)) {
+                            codes[column] = static_cast<uint8_t>(LoSClass::LoS);
+                            continue;
+                        }
+                        if (IsInSector(span.bearing(), lowerBound, upperBound)) {
+                            bandTargets[band][wedgeOf(span.center)] = 1;
+                        } else {
+                            codes[column] = static_cast<uint8_t>(LoSClass::OutsideRegion);
+                        }
+                        forEachWedge(span, [&](int wedge) { bandCounts[band][wedge]++; });
+                    }
+                }
+            });
+        }
+        bandTasks.wait();
+    }
+
+    // Offsets of every (wedge, band) bucket in one flat array, so the fill pass writes in place
+    vector<size_t> wedgeStart(VIEWSHED_WEDGES + 1, 0);
+    vector<vector<size_t>> bandOffsets(numBands, vector<size_t>(VIEWSHED_WEDGES));
+    vector<uint8_t> wedgeHasTargets(VIEWSHED_WEDGES, 0);
+    size_t totalEntries = 0;
+    for (int wedge = 0; wedge < VIEWSHED_WEDGES; ++wedge) {
+        wedgeStart[wedge] = totalEntries;
+        for (int band = 0; band < numBands; ++band) {
+            bandOffsets[band][wedge] = totalEntries;
+            totalEntries += bandCounts[band][wedge];
+            wedgeHasTargets[wedge] |= bandTargets[band][wedge];
+        }
+    }
+    wedgeStart[VIEWSHED_WEDGES] = totalEntries;
+    bandCounts.clear();
+    bandTargets.clear();
+
+    vector<uint32_t> entries(totalEntries);
+    {
+        TaskGroup bandTasks(GetThreadPool());
+        for (int band = 0; band < numBands; ++band) {
+            bandTasks.run([&, band] {
+                vector<size_t>& offsets = bandOffsets[band];
+                int lastRow = std::min(window.height, (band + 1) * VIEWSHED_BAND_ROWS);
+                for (int row = band * VIEWSHED_BAND_ROWS; row < lastRow; ++row) {
+                    for (int column = 0; column < window.width; ++column) {
+                        int pixel = window.xOff + column;
+                        int line = window.yOff + row;
+                        CellSpan span = GetCellSpan(frame, pixel, line);
+                        if (span.distance > radius || !isSwept(pixel, line, span)) {
+                            continue;
+                        }
+                        uint32_t cell = static_cast<uint32_t>(row) * window.width + column;
+                        forEachWedge(span, [&](int wedge) { entries[offsets[wedge]++] = cell; });
+                    }
+                }
+            });
+        }
+        bandTasks.wait();
+    }
+    bandOffsets.clear();
+
+    double downtiltSlope = GetDowntiltSlope(antenna.dt);
+    bool sameGrid = DsmReader().hasSameGrid(GroundReader());
+
+    enum EventType : uint8_t { Enter, Center, Exit };
+    struct SweepEvent {
+        double angle;
+        EventType type;
+        uint32_t slot;
+        bool operator<(const SweepEvent& other) const {
+            return angle < other.angle || (angle == other.angle && type < other.type);
+        }
+    };
+
+    TaskGroup wedgeTasks(GetThreadPool());
+    for (int wedge = 0; wedge < VIEWSHED_WEDGES; ++wedge) {
+        if (!wedgeHasTargets[wedge]) {
+            continue;
+        }
+        wedgeTasks.run([&, wedge] {
+            double wedgeLow = wedge * wedgeAngle;
+            double wedgeHigh = wedgeLow + wedgeAngle;
+            size_t first = wedgeStart[wedge];
+            size_t count = wedgeStart[wedge + 1] - first;
+
+            vector<CellSpan> spans(count);
+            vector<float> ueElevations(count);
+            vector<SweepEvent> events;
+            for (size_t slot = 0; slot < count; ++slot) {
+                uint32_t cell = entries[first + slot];
+                int pixel = window.xOff + static_cast<int>(cell % window.width);
+                int line = window.yOff + static_cast<int>(cell / window.width);
+                CellSpan& span = spans[slot];
+                span = GetCellSpan(frame, pixel, line);
+                ueElevations[slot] = static_cast<float>(GetElevationAtPixel(pixel, line, UE_HEIGHT));
+                bool isTarget = wedgeOf(span.center) == wedge;
+
+                // Bring the span to the turn overlapping this slice
+                double shift = PSEUDO_TURN * std::round((wedgeLow + 0.5 * wedgeAngle - span.center) / PSEUDO_TURN);
+                span.low += shift;
+                span.high += shift;
+                span.center += shift;
+
+                // Cells already crossing the first angle enter before the sweep starts
+                events.push_back({span.low <= wedgeLow ? -std::numeric_limits<double>::infinity() : span.low, Enter,
+                                  static_cast<uint32_t>(slot)});
+                if (isTarget) {
+                    events.push_back({span.center, Center, static_cast<uint32_t>(slot)});
+                }
+                if (span.high < wedgeHigh) {
+                    events.push_back({span.high, Exit, static_cast<uint32_t>(slot)});
+                }
+            }
+            std::sort(events.begin(), events.end());
+
+            // Distance ranks of the cells. The cells in front of a target are the ranks before
+            // the first cell as far as it.
+            vector<uint32_t> byDistance(count);
+            for (size_t slot = 0; slot < count; ++slot) {
+                byDistance[slot] = static_cast<uint32_t>(slot);
+            }
+            std::sort(byDistance.begin(), byDistance.end(), [&](uint32_t a, uint32_t b) {
+                return spans[a].distance < spans[b].distance;
+            });
+            vector<uint32_t> rank(count);
+            vector<uint32_t> frontEnd(count);
+            for (size_t r = 0; r < count; ++r) {
+                uint32_t slot = byDistance[r];
+                rank[slot] = static_cast<uint32_t>(r);
+                bool tied = r > 0 && spans[byDistance[r - 1]].distance == spans[slot].distance;
+                frontEnd[slot] = tied ? frontEnd[byDistance[r - 1]] : static_cast<uint32_t>(r);
+            }
+
+            SweepTree tree;
+            tree.reset(count);
+            for (const SweepEvent& event : events) {
+                const CellSpan& span = spans[event.slot];
+                double ueElevation = ueElevations[event.slot];
+                if (event.type == Enter) {
+                    if (std::isnan(ueElevation)) { // Nodata cells hide nothing
+                        continue;
+                    }
+                    tree.insert(rank[event.slot], static_cast<float>((ueElevation - UE_HEIGHT - antElevation) / span.distance),
+                                static_cast<float>((ueElevation - antElevation) / span.distance));
+                    continue;
+                }
+                if (event.type == Exit) {
+                    tree.erase(rank[event.slot]);
+                    continue;
+                }
+                if (!IsInSector(span.bearing(), lowerBound, upperBound)) {
+                    continue;
+                }
+
+                uint32_t cell = entries[first + event.slot];
+                int row = static_cast<int>(cell / window.width);
+                int column = static_cast<int>(cell % window.width);
+                SweepTree::Slopes front = tree.maxBefore(frontEnd[event.slot]);
+                LoSClass cellClass = LoSClass::NLoS;
+                if (std::isnan(ueElevation)) {
+                    cellClass = LoSClass::NoData;
+                } else if (front.ue <= downtiltSlope && (ueElevation - antElevation) / span.distance > front.obstacle) {
+                    bool inBuilding = IsCellInBuilding(window.xOff + column, window.yOff + row, ueElevation, antCoord, span, sameGrid);
+                    cellClass = inBuilding ? LoSClass::LoSInBuilding : LoSClass::LoS;
+                }
+                result.getRowCodes(row)[column] = static_cast<uint8_t>(cellClass);
+            }
+            DsmReader().flushCacheStats();
+            GroundReader().flushCacheStats();
+        });
+    }
+    wedgeTasks.wait();
+
+    cout << "success for antenna id : " << antenna.id << endl;
+
+    return result;
+}
+
+// Visible DSM pixels of a result, with their distance to the antenna, to fold into the coverage maps.
+// Ray samples keep their distance along the ray; raster cells are measured from the antenna to their center.
+vector<CoverageHit> GetVisibleCells(const LoSResult& result, const CoverageMaps& coverage) {
+    vector<CoverageHit> hits;
+    if (result.isRaster()) {
+        PixelFrame frame;
+        if (!frame.init(result.getOrigin())) {
+            return hits;
+        }
+        const gloss::RasterWindow& window = result.getRasterWindow();
+        for (int row = 0; row < window.height; ++row) {
+            const uint8_t* codes = result.getRowCodes(row);
+            for (int column = 0; column < window.width; ++column) {
+                if (IsVisible(codes[column])) {
+                    int pixel = window.xOff + column;
+                    int line = window.yOff + row;
+                    hits.push_back(coverage.makeHit(pixel, line, GetCellSpan(frame, pixel, line).distance));
+                }
+            }
+        }
+        return hits;
+    }
+
+    ElevationReader& dsm = DsmReader();
+    for (size_t ray = 0; ray < result.getNumRays(); ++ray) {
+        const uint8_t* codes = result.getRayCodes(ray);
+        RaySampler sampler(result.getOrigin(), result.getRay(ray));
+        RaySample sample;
+        for (int i = 0; i < result.getNumSamples(ray) && sampler.next(sample); ++i) {
+            if (IsVisible(codes[i]) && sample.pixel != NO_PIXEL && dsm.containsPixel(sample.pixel, sample.line)) {
+                hits.push_back(coverage.makeHit(sample.pixel, sample.line, sample.distance));
+            }
+        }
+    }
+    return hits;
+}
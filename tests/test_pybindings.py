@@ -1,4 +1,8 @@
+import os
+import tempfile
+
 import gloss as m
+import numpy as np
 
 output = m.printHelloWorld()
 print(output)
@@ -15,9 +19,110 @@ m.initialize(antenna_file, data_path, data_mnt_path)
 print("Initialization complete")
 
 # Compute
+m.setEngine(m.LoSEngine.Rays)
+m.setAngularRefinement(1.0)
+print(f"Ray kernel: {m.getRayKernel()}")
 results = m.compute()
 print(f"Computation complete. Processed {len(results)} antennas")
+print(f"Tile cache: {m.getCacheStats()}")
+for antenna_id, result in results.items():
+    print(f"Antenna {antenna_id}: {result}, {result.getMemoryUsage()} bytes")
+    print(f"  classes {result.getClassArray().shape}, samples {result.getSampleCounts().sum()}")
+    print(f"  ray 0 transitions {m.toHorizons(result)[0]}")
+    print(f"  samples without DSM data {(result.getClassArray() == int(m.LoSClass.NoData)).sum()}")
+
+# Angular refinement: rays are bisected between profiles that disagree, down to a quarter degree
+m.setAngularRefinement(0.25)
+refined = m.compute()
+refined_rays = 0
+for antenna_id, result in refined.items():
+    bearings = result.getBearings()
+    assert len(bearings) >= len(results[antenna_id])
+    refined_rays += int((bearings % 1.0 != 0.0).sum())
+assert refined_rays > 0
+print(f"Refinement complete. {refined_rays} sub-degree rays added")
+m.setAngularRefinement(1.0)
+
+# Viewshed engine: one raster of class codes per antenna, on the DSM grid
+m.setEngine(m.LoSEngine.Viewshed)
+viewsheds = m.compute()
+viewshed_codes = {int(c) for c in (m.LoSClass.NLoS, m.LoSClass.OutsideRegion, m.LoSClass.LoSInBuilding,
+                                   m.LoSClass.LoS, m.LoSClass.NoData, m.LoSClass.NoSample)}
+for antenna_id, result in viewsheds.items():
+    window = result.getRasterWindow()
+    classes = result.getClassArray()
+    assert result.isRaster()
+    assert classes.shape == (window.height, window.width)
+    assert set(np.unique(classes).tolist()) <= viewshed_codes
+    assert (classes == int(m.LoSClass.LoS)).any()
+print(f"Viewshed complete. Processed {len(viewsheds)} antennas")
+m.setEngine(m.LoSEngine.Rays)
+
+handle = m.computeAsync()
+try:
+    m.setNumThreads(m.getNumThreads())
+    print("Async computation finished before setNumThreads")
+except RuntimeError as error:
+    print(f"setNumThreads refused during computeAsync: {error}")
+try:
+    m.setOutputFormat(m.OutputFormat.Binary)
+    print("Async computation finished before setOutputFormat")
+except RuntimeError as error:
+    print(f"setOutputFormat refused during computeAsync: {error}")
+print(f"Async computation complete. Processed {len(handle.result())} antennas")
 
 # Optionally save results
 m.saveResults(results)
-print("Results saved")
\ No newline at end of file
+print("Results saved")
+print(f"Reloaded {len(m.loadResults('los_datasets/'))} antennas")
+m.setOutputFormat(m.OutputFormat.GeoTiff)
+m.saveResults(results)
+print("GeoTIFF results saved")
+m.setCoverage(True)
+m.compute()
+coverage = m.getCoverage()
+print(f"Coverage: {(coverage.getLoSCount() > 0).sum()} pixels in LoS, best antennas {set(coverage.getBestAntenna().ravel()) - {-1}}")
+m.setCoverage(False)
+columns = ["lat", "lon", "height", "frequency", "erp", "name", "azimuth", "dt", "bandwidth", "ba", "gnd_elevation"]
+antenna_table = np.genfromtxt(antenna_file, delimiter=";", dtype=None, encoding=None, names=columns)
+try:
+    m.setAntennas(antenna_table, id=np.ones(len(antenna_table), dtype=np.int32))
+    assert len(antenna_table) < 2, "duplicate antenna ids were accepted"
+except ValueError as error:
+    print(f"Duplicate ids rejected: {error}")
+m.setAntennas(antenna_table)
+print(f"Computed {len(m.compute())} antennas from a structured array")
+
+# Lane kernels: pixel rays on in-memory rasters get the same codes whatever the instruction set
+m.initialize(antenna_file, data_path, data_mnt_path, True)
+m.setTraversalMode(m.TraversalMode.Pixel)
+kernel_results = {}
+for kernel in ("scalar", "sse2", "avx2"):
+    try:
+        m.setRayKernel(kernel)
+    except RuntimeError:
+        print(f"Ray kernel {kernel} not available")
+        continue
+    assert m.getRayKernel() == kernel
+    kernel_results[kernel] = m.compute()
+m.setRayKernel("auto")
+scalar_results = kernel_results.pop("scalar")
+for kernel, kernel_result in kernel_results.items():
+    for antenna_id, result in scalar_results.items():
+        assert np.array_equal(result.getClassArray(), kernel_result[antenna_id].getClassArray()), kernel
+    print(f"Ray kernel {kernel} matches the scalar kernel on {len(scalar_results)} antennas")
+
+# .glossdem round trip: the converted rasters give the same codes as the GeoTIFFs they come from
+m.setTraversalMode(m.TraversalMode.LatLon)
+tiff_results = m.compute()
+with tempfile.TemporaryDirectory() as glossdem_dir:
+    dsm_glossdem = os.path.join(glossdem_dir, "montreal.glossdem")
+    ground_glossdem = os.path.join(glossdem_dir, "montreal_MNT.glossdem")
+    m.convertToGlossDem(data_path, dsm_glossdem)
+    m.convertToGlossDem(data_mnt_path, ground_glossdem)
+    m.initialize(antenna_file, dsm_glossdem, ground_glossdem)
+    glossdem_results = m.compute()
+assert glossdem_results.keys() == tiff_results.keys()
+for antenna_id, result in tiff_results.items():
+    assert np.array_equal(result.getClassArray(), glossdem_results[antenna_id].getClassArray()), antenna_id
+print(f".glossdem rasters match the GeoTIFFs on {len(tiff_results)} antennas")